@@ -0,0 +1,195 @@
+#include "affinity.h"
+
+struct child_placement child_placement;
+
+static const struct {
+    const char *name;
+    int policy;
+} sched_policies[] = {
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+    {"fifo", SCHED_FIFO},
+    {"rr", SCHED_RR},
+};
+
+int parse_cpu_list(const char *text, struct child_placement *placement) {
+    // Parses a list like 0-7,12,14-15
+    // Returns 0 on success, or -1 if text is not a CPU list
+    CPU_ZERO(&placement->cpus);
+    placement->cpu_count = 0;
+    const char *s = text;
+    while (*s != '\0') {
+        char *end;
+        long first = strtol(s, &end, 10);
+        if (end == s || first < 0) {
+            return -1;
+        }
+        long last = first;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        long cpu;
+        for (cpu = first; cpu <= last; ++cpu) {
+            if (!CPU_ISSET(cpu, &placement->cpus) && placement->cpu_count < MAX_PIN_CPUS) {
+                placement->cpu_list[placement->cpu_count++] = cpu;
+            }
+            CPU_SET(cpu, &placement->cpus);
+        }
+        if (*end == ',') {
+            ++end;
+        }
+        else if (*end != '\0') {
+            return -1;
+        }
+        s = end;
+    }
+    placement->has_cpus = placement->cpu_count > 0;
+    return placement->has_cpus ? 0 : -1;
+}
+
+int parse_sched_policy(const char *name, int *policy) {
+    size_t k;
+    for (k = 0; k < sizeof(sched_policies) / sizeof(sched_policies[0]); ++k) {
+        if (strcmp(sched_policies[k].name, name) == 0) {
+            *policy = sched_policies[k].policy;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void pin_builtin(char **args, int count) {
+    // pin [CPUS] [--nice N] [--policy NAME] [--priority N] [--spread] command [args...]
+    // The placement applies to every stage of the pipeline that command
+    // starts, or to every job of parallel
+    struct child_placement placement;
+    memset(&placement, 0, sizeof(placement));
+    int k = 0;
+    const char *error = NULL;
+    if (k < count && args[k][0] >= '0' && args[k][0] <= '9') {
+        if (parse_cpu_list(args[k], &placement) < 0) {
+            error = "invalid CPU list";
+        }
+        ++k;
+    }
+    while (error == NULL && k < count && strncmp(args[k], "--", 2) == 0) {
+        const char *option = args[k];
+        const char *value = (k + 1 < count) ? args[k + 1] : NULL;
+        char *end;
+        if (strcmp(option, "--spread") == 0) {
+            placement.spread = TRUE;
+            ++k;
+            continue;
+        }
+        if (value == NULL) {
+            error = "missing option value";
+        }
+        else if (strcmp(option, "--nice") == 0) {
+            placement.nice = strtol(value, &end, 10);
+            placement.has_nice = TRUE;
+            if (*end != '\0') {
+                error = "invalid niceness";
+            }
+        }
+        else if (strcmp(option, "--policy") == 0) {
+            placement.has_policy = TRUE;
+            if (parse_sched_policy(value, &placement.policy) < 0) {
+                error = "policy must be other, batch, idle, fifo, or rr";
+            }
+        }
+        else if (strcmp(option, "--priority") == 0) {
+            placement.priority = strtol(value, &end, 10);
+            if (*end != '\0') {
+                error = "invalid priority";
+            }
+        }
+        else {
+            error = "invalid option";
+        }
+        k += 2;
+    }
+    if (error == NULL && k == count) {
+        error = "usage: pin [CPUS] [--nice N] [--policy NAME] [--priority N] [--spread] command [args...]";
+    }
+    if (error == NULL && placement.spread && !placement.has_cpus) {
+        error = "--spread needs a CPU list";
+    }
+    // parallel starts children of its own, and limit, timeout and batch run
+    // the rest of the line, so the placement reaches the children they start
+    if (error == NULL && is_builtin(args[k]) && strcmp(args[k], cmd_parallel) != 0
+        && strcmp(args[k], cmd_limit) != 0 && strcmp(args[k], cmd_timeout) != 0
+        && strcmp(args[k], cmd_batch) != 0) {
+        error = "cannot pin a built-in";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: pin: %s\n", error);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (placement.has_policy && placement.priority == 0
+        && (placement.policy == SCHED_FIFO || placement.policy == SCHED_RR)) {
+        // Real-time policies need a priority of at least 1
+        placement.priority = 1;
+    }
+    placement.active = TRUE;
+    child_placement = placement;
+    // Run the rest of the line as the command; the placement stays active
+    // until the last stage of the pipeline has been started
+    char **saved_opts = opts;
+    int saved_count = optCount;
+    opts = &args[k];
+    optCount = count - k;
+    execute();
+    opts = saved_opts;
+    optCount = saved_count;
+}
+
+int apply_child_placement() {
+    // Called in the child between fork and exec, so no helper binaries
+    // (taskset, nice, chrt) have to be exec'd
+    // Returns -1 with errno set if the placement could not be applied
+    struct child_placement *placement = &child_placement;
+    if (!placement->active) {
+        return 0;
+    }
+    if (placement->has_cpus) {
+        if (placement->spread) {
+            // next_stage was advanced by the parent after the fork
+            cpu_set_t stage_cpus;
+            CPU_ZERO(&stage_cpus);
+            CPU_SET(placement->cpu_list[placement->next_stage % placement->cpu_count], &stage_cpus);
+            if (sched_setaffinity(0, sizeof(stage_cpus), &stage_cpus) < 0) {
+                return -1;
+            }
+        }
+        else if (sched_setaffinity(0, sizeof(placement->cpus), &placement->cpus) < 0) {
+            return -1;
+        }
+    }
+    if (placement->has_policy) {
+        struct sched_param param = {placement->priority};
+        if (sched_setscheduler(0, placement->policy, &param) < 0) {
+            return -1;
+        }
+    }
+    if (placement->has_nice) {
+        errno = 0;
+        if (nice(placement->nice) == -1 && errno) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void clear_child_placement() {
+    child_placement.active = FALSE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "shell.h"
+#include <sched.h>
+#include <sys/resource.h>
+
+// Constants
+#define MAX_PIN_CPUS 1024
+
+// Where and how the children of the current pipeline run, set by pin
+struct child_placement {
+    char active;
+    char has_cpus;
+    cpu_set_t cpus;
+    int cpu_list[MAX_PIN_CPUS];
+    int cpu_count;
+    // Give each pipeline stage its own CPU from the list
+    char spread;
+    int next_stage;
+    char has_nice;
+    int nice;
+    char has_policy;
+    int policy;
+    int priority;
+};
+
+// Function type signatures
+int parse_cpu_list(const char *text, struct child_placement *placement);
+int parse_sched_policy(const char *name, int *policy);
+void pin_builtin(char **args, int count);
+int apply_child_placement();
+void clear_child_placement();
+
+// Variables
+extern struct child_placement child_placement;
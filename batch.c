@@ -0,0 +1,186 @@
+#include "batch.h"
+#include "process.h"
+#include "functions.h"
+
+extern char **environ;
+
+struct batch_settings batch_settings = {FALSE, 0, 0};
+
+static long string_cost(const char *s) {
+    // What a string takes up in the new process image: its bytes and a pointer
+    return strlen(s) + 1 + sizeof(char *);
+}
+
+long argv_size(char **argv, int count) {
+    long size = sizeof(char *);
+    int k;
+    for (k = 0; k < count; ++k) {
+        size += string_cost(argv[k]);
+    }
+    return size;
+}
+
+long batch_arg_limit() {
+    // Bytes left for the arguments once the environment has been copied
+    long limit = sysconf(_SC_ARG_MAX);
+    if (limit <= 0) {
+        limit = _POSIX_ARG_MAX;
+    }
+    // The kernel also caps the arguments at a quarter of the stack limit,
+    // which sysconf() doesn't go below 128K for
+    struct rlimit stack_limit;
+    if (getrlimit(RLIMIT_STACK, &stack_limit) == 0 && stack_limit.rlim_cur != RLIM_INFINITY
+        && (long) (stack_limit.rlim_cur / 4) < limit) {
+        limit = stack_limit.rlim_cur / 4;
+    }
+    char **variable;
+    for (variable = environ; *variable != NULL; ++variable) {
+        limit -= string_cost(*variable);
+    }
+    return limit - BATCH_HEADROOM;
+}
+
+int should_batch(char **argv, int count) {
+    // TRUE if argv has to be split, because the batch prefix or the arg_batch
+    // option asked for it and it won't fit into a single exec
+    if (batch_settings.active) {
+        return batch_settings.max_args > 0 || argv_size(argv, count) > batch_arg_limit();
+    }
+    return get_option(OPT_ARG_BATCH) > 0 && argv_size(argv, count) > batch_arg_limit();
+}
+
+int batch_fixed_count(char **argv, int count) {
+    // The command and its leading options are repeated in every batch, and
+    // the arguments after them are split, like the items of xargs
+    int k = 1;
+    while (k < count && argv[k][0] == '-' && argv[k][1] != '\0') {
+        if (strcmp(argv[k++], "--") == 0) {
+            break;
+        }
+    }
+    return k;
+}
+
+int run_batches(char **argv, int count) {
+    // Runs argv as several commands, each with as many of the trailing
+    // arguments as fit, waiting for the oldest once enough are running
+    // Returns the wait status of the first batch that failed (or of the last
+    // one), or -1 with errno set if a batch could not be started
+    int jobs = batch_settings.active ? batch_settings.jobs : get_option(OPT_ARG_BATCH);
+    int max_args = batch_settings.active ? batch_settings.max_args : 0;
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > MAX_BATCH_JOBS) {
+        jobs = MAX_BATCH_JOBS;
+    }
+    int fixed = batch_fixed_count(argv, count);
+    long budget = batch_arg_limit() - argv_size(argv, fixed);
+    int k;
+    for (k = fixed; k < count; ++k) {
+        if (strlen(argv[k]) >= BATCH_MAX_ARG_LENGTH || string_cost(argv[k]) > budget) {
+            errno = E2BIG;
+            return -1;
+        }
+    }
+    char **batch_argv = (char **) malloc((count + 1) * sizeof(char *));
+    memcpy(batch_argv, argv, fixed * sizeof(char *));
+    int pids[MAX_BATCH_JOBS];
+    int running = 0;
+    int result = 0;
+    char failed = FALSE;
+    int next = fixed;
+    // Runs at least once, so a command without trailing arguments still runs
+    do {
+        int batch_count = fixed;
+        long size = 0;
+        while (next < count
+               && (max_args == 0 || batch_count - fixed < max_args)
+               && size + string_cost(argv[next]) <= budget) {
+            size += string_cost(argv[next]);
+            batch_argv[batch_count++] = argv[next++];
+        }
+        batch_argv[batch_count] = NULL;
+        if (running == jobs) {
+            int status;
+            wait_for_children(pids, &status, 1);
+            memmove(pids, &pids[1], (running - 1) * sizeof(int));
+            --running;
+            if (!failed) {
+                result = status;
+                failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            }
+        }
+        int pid = spawn_command(batch_argv);
+        if (pid < 0) {
+            result = -1;
+            break;
+        }
+        pids[running++] = pid;
+    } while (next < count && !interrupted);
+    // Wait for the rest even after a failure, so nothing is left behind
+    int spawn_error = errno;
+    int statuses[MAX_BATCH_JOBS];
+    if (running > 0 && wait_for_children(pids, statuses, running) == 0) {
+        for (k = 0; k < running && !failed && result >= 0; ++k) {
+            result = statuses[k];
+            failed = !WIFEXITED(statuses[k]) || WEXITSTATUS(statuses[k]) != 0;
+        }
+    }
+    free(batch_argv);
+    child_pid = 0;
+    errno = spawn_error;
+    return result;
+}
+
+void batch_builtin(char **args, int count) {
+    // batch [-j JOBS] [-n MAX_ARGS] command [args...]
+    // Runs command once per batch of arguments if they don't fit into a
+    // single exec (or more than MAX_ARGS are given)
+    struct batch_settings settings = {TRUE, 1, 0};
+    int k = 0;
+    const char *error = NULL;
+    while (error == NULL && k < count && args[k][0] == '-') {
+        char *end;
+        long value = (k + 1 < count) ? strtol(args[k + 1], &end, 10) : 0;
+        if (k + 1 >= count || *end != '\0' || value < 1) {
+            error = "option needs a positive number";
+        }
+        else if (strcmp(args[k], "-j") == 0) {
+            settings.jobs = (value > MAX_BATCH_JOBS) ? MAX_BATCH_JOBS : value;
+        }
+        else if (strcmp(args[k], "-n") == 0) {
+            settings.max_args = value;
+        }
+        else {
+            error = "invalid option";
+        }
+        k += 2;
+    }
+    if (error == NULL && k >= count) {
+        error = "usage: batch [-j JOBS] [-n MAX_ARGS] command [args...]";
+    }
+    // Built-ins never exec, so there is nothing to split
+    if (error == NULL && is_builtin(args[k])) {
+        error = "cannot batch a built-in";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: batch: %s\n", error);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    // Run the rest of the line as the command; a function runs as it is,
+    // without its own commands being split
+    if (find_function(args[k]) == NULL) {
+        batch_settings = settings;
+    }
+    char **saved_opts = opts;
+    int saved_count = optCount;
+    opts = &args[k];
+    optCount = count - k;
+    execute();
+    opts = saved_opts;
+    optCount = saved_count;
+    batch_settings.active = FALSE;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "shell.h"
+#include "options.h"
+#include <sys/resource.h>
+
+// Constants
+// Room left for the kernel's own bookkeeping, like xargs does
+#define BATCH_HEADROOM 2048
+// The kernel's limit on a single argument (MAX_ARG_STRLEN)
+#define BATCH_MAX_ARG_LENGTH (32 * 4096)
+#define MAX_BATCH_JOBS 64
+
+// How the current command is split when its arguments don't fit
+struct batch_settings {
+    char active;
+    // Batches run at once; 1 runs them one after another
+    int jobs;
+    // Most trailing arguments per batch, or 0 for as many as fit
+    int max_args;
+};
+
+// Function type signatures
+long argv_size(char **argv, int count);
+long batch_arg_limit();
+int should_batch(char **argv, int count);
+int batch_fixed_count(char **argv, int count);
+int run_batches(char **argv, int count);
+void batch_builtin(char **args, int count);
+
+// Variables
+extern struct batch_settings batch_settings;
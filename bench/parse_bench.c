@@ -0,0 +1,142 @@
+// Measures parse throughput by sourcing generated scripts whose commands
+// (the : built-in) do nothing
+// Usage: parse_bench [shell] [megabytes]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SHELL "./shell"
+#define DEFAULT_MEGABYTES 8
+#define RUNS 3
+#define COMMAND_MAX_SIZE 512
+
+// A line of each kind, repeated until the script is big enough
+struct workload {
+    const char *name;
+    // Words per line
+    int words;
+    const char *(*word)(int k);
+};
+
+static const char *plain_word(int k) {
+    // Words that need no expansion still go through parse_input() once a
+    // line contains a quote
+    static char word[64];
+    snprintf(word, sizeof(word), k == 0 ? "\"generated/path/number_%d.txt\"" : "generated/path/number_%d.txt", k);
+    return word;
+}
+
+static const char *quoted_word(int k) {
+    static char word[64];
+    snprintf(word, sizeof(word), (k % 2) ? "'single quoted %d'" : "\"double quoted %d\"", k);
+    return word;
+}
+
+static const char *mixed_word(int k) {
+    static char word[64];
+    switch (k % 4) {
+        case 0: snprintf(word, sizeof(word), "plain_argument_%d", k); break;
+        case 1: snprintf(word, sizeof(word), "\"$HOME/quoted %d\"", k); break;
+        case 2: snprintf(word, sizeof(word), "escaped\\ space\\ %d", k); break;
+        default: snprintf(word, sizeof(word), "--option=value_%d", k); break;
+    }
+    return word;
+}
+
+static struct workload workloads[] = {
+    {"short lines", 8, mixed_word},
+    {"long lines", 2000, plain_word},
+    {"quoted", 16, quoted_word},
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long write_script(const char *path, struct workload *workload, long bytes) {
+    // Returns the size of the script written
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    long written = 0;
+    while (written < bytes) {
+        written += fprintf(file, ":");
+        int k;
+        for (k = 0; k < workload->words; ++k) {
+            written += fprintf(file, " %s", workload->word(k));
+        }
+        written += fprintf(file, "\n");
+    }
+    fclose(file);
+    return written;
+}
+
+static double run_shell(const char *shell, const char *path) {
+    // Returns the seconds taken to source path, or -1 on failure
+    char command[COMMAND_MAX_SIZE];
+    snprintf(command, sizeof(command), "source %s", path);
+    double start = now();
+    int pid = fork();
+    if (!pid) {
+        int dev_null = open("/dev/null", O_RDWR);
+        dup2(dev_null, STDIN_FILENO);
+        dup2(dev_null, STDOUT_FILENO);
+        execl(shell, shell, "-c", command, (char *) NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    const char *shell = argc > 1 ? argv[1] : DEFAULT_SHELL;
+    long megabytes = argc > 2 ? atol(argv[2]) : DEFAULT_MEGABYTES;
+    char path[] = "/tmp/ship_parse_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    printf("%-12s %10s %10s\n", "workload", "MB", "MB/s");
+    size_t k;
+    int result = 0;
+    for (k = 0; k < sizeof(workloads) / sizeof(workloads[0]); ++k) {
+        long size = write_script(path, &workloads[k], megabytes << 20);
+        if (size < 0) {
+            result = 1;
+            break;
+        }
+        // Best of several runs
+        double best = -1;
+        int run;
+        for (run = 0; run < RUNS; ++run) {
+            double seconds = run_shell(shell, path);
+            if (seconds < 0) {
+                fprintf(stderr, "%s failed\n", shell);
+                result = 1;
+                break;
+            }
+            if (best < 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        printf("%-12s %10.1f %10.1f\n", workloads[k].name, size / 1048576.0, size / 1048576.0 / best);
+    }
+    unlink(path);
+    return result;
+}
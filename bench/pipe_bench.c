@@ -0,0 +1,76 @@
+// Measures pipeline throughput and context switches for several pipe sizes
+// Usage: pipe_bench [shell] [megabytes]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define DEFAULT_SHELL "./shell"
+#define DEFAULT_MEGABYTES 1024
+#define SCRIPT_MAX_SIZE 512
+
+static const char *pipe_sizes[] = {"0", "256K", "1M"};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run_shell(const char *shell, const char *script, double *seconds, struct rusage *usage) {
+    // Feeds script to the shell on stdin and measures it along with every
+    // process the shell waited for
+    int pipes[2];
+    if (pipe(pipes) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    double start = now();
+    int pid = fork();
+    if (!pid) {
+        dup2(pipes[0], STDIN_FILENO);
+        close(pipes[0]);
+        close(pipes[1]);
+        int dev_null = open("/dev/null", O_WRONLY);
+        dup2(dev_null, STDOUT_FILENO);
+        dup2(dev_null, STDERR_FILENO);
+        execl(shell, shell, (char *) NULL);
+        _exit(127);
+    }
+    close(pipes[0]);
+    write(pipes[1], script, strlen(script));
+    close(pipes[1]);
+    int status;
+    if (wait4(pid, &status, 0, usage) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    *seconds = now() - start;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *shell = argc > 1 ? argv[1] : DEFAULT_SHELL;
+    long megabytes = argc > 2 ? atol(argv[2]) : DEFAULT_MEGABYTES;
+    printf("%-10s %10s %16s\n", "pipe_size", "MB/s", "ctx switches");
+    size_t k;
+    for (k = 0; k < sizeof(pipe_sizes) / sizeof(pipe_sizes[0]); ++k) {
+        char script[SCRIPT_MAX_SIZE];
+        // A three stage pipeline moving data without doing work on it
+        snprintf(script, sizeof(script),
+                 "shopt pipe_size %s\nhead -c %ldM /dev/zero | cat | cat > /dev/null\nexit\n",
+                 pipe_sizes[k], megabytes);
+        double seconds;
+        struct rusage usage;
+        if (run_shell(shell, script, &seconds, &usage) < 0) {
+            fprintf(stderr, "Could not run %s\n", shell);
+            return 1;
+        }
+        printf("%-10s %10.1f %16ld\n", pipe_sizes[k], megabytes / seconds, usage.ru_nvcsw + usage.ru_nivcsw);
+    }
+    return 0;
+}
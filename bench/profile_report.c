@@ -0,0 +1,80 @@
+// Reports binary size, startup time and peak RSS for several shell builds
+// Usage: profile_report shell...
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define STARTUP_RUNS 200
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static int run_once(const char *shell, double *seconds, long *max_rss) {
+    // Runs "shell -c true", which initializes everything but skips the rc
+    // file and the prompt
+    double start = now();
+    int pid = fork();
+    if (!pid) {
+        int dev_null = open("/dev/null", O_RDWR);
+        dup2(dev_null, STDIN_FILENO);
+        dup2(dev_null, STDOUT_FILENO);
+        dup2(dev_null, STDERR_FILENO);
+        execl(shell, shell, "-c", "true", (char *) NULL);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    *seconds = now() - start;
+    if (usage.ru_maxrss > *max_rss) {
+        *max_rss = usage.ru_maxrss;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s shell...\n", argv[0]);
+        return 2;
+    }
+    printf("%-24s %12s %14s %14s %12s\n", "binary", "size (KB)", "startup p50", "startup p90", "RSS (KB)");
+    int k;
+    for (k = 1; k < argc; ++k) {
+        struct stat binary_stat;
+        if (stat(argv[k], &binary_stat) < 0) {
+            perror(argv[k]);
+            return 1;
+        }
+        double times[STARTUP_RUNS];
+        long max_rss = 0;
+        int run;
+        for (run = 0; run < STARTUP_RUNS; ++run) {
+            if (run_once(argv[k], &times[run], &max_rss) != 0) {
+                fprintf(stderr, "%s -c true failed\n", argv[k]);
+                return 1;
+            }
+        }
+        qsort(times, STARTUP_RUNS, sizeof(double), compare_doubles);
+        printf("%-24s %12lld %11.0f us %11.0f us %12ld\n", argv[k], (long long) binary_stat.st_size / 1024,
+               times[STARTUP_RUNS / 2] * 1e6, times[STARTUP_RUNS * 9 / 10] * 1e6, max_rss);
+    }
+    return 0;
+}
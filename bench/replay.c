@@ -0,0 +1,294 @@
+// Replays a session recorded with SHIP_RECORD through a pty and reports
+// latency percentiles for each shell given
+// Usage: replay session.log [shell...]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+
+#define DEFAULT_SHELL "./shell"
+#define LINE_MAX_SIZE 4096
+#define READ_BUF_SIZE 4096
+#define PROMPT_TIMEOUT_MS 30000
+#define TERMINAL_COLUMNS 200
+#define TERMINAL_ROWS 50
+// The main prompt ends in a line of ">> " and the continuation prompt is
+// "> ", matched once colors are stripped so builds without them work too
+#define PROMPT_MARKER_SIZE 4
+
+// A growable list of durations in microseconds
+struct samples {
+    long long *values;
+    size_t count;
+    size_t capacity;
+};
+
+static char **session_lines = NULL;
+static size_t session_line_count = 0;
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void add_sample(struct samples *samples, long long value) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 64;
+        samples->values = (long long *) realloc(samples->values, samples->capacity * sizeof(long long));
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int compare_samples(const void *a, const void *b) {
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+static long long percentile(struct samples *samples, int p) {
+    // Nearest-rank percentile of the sorted samples
+    size_t rank = (samples->count * p + 99) / 100;
+    return samples->values[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_samples(const char *phase, struct samples *samples) {
+    if (samples->count == 0) {
+        printf("  %-14s %8s %10s %10s %10s\n", phase, "0", "-", "-", "-");
+        return;
+    }
+    qsort(samples->values, samples->count, sizeof(long long), compare_samples);
+    printf("  %-14s %8zu %10lld %10lld %10lld\n", phase, samples->count,
+           percentile(samples, 50), percentile(samples, 90), percentile(samples, 99));
+}
+
+static int read_session(const char *path) {
+    // Each record is "<timestamp>\t<line>"; lines without a timestamp are
+    // replayed as they are so that sessions can also be written by hand
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[LINE_MAX_SIZE];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *text = line;
+        char *tab = strchr(line, '\t');
+        if (tab != NULL && strspn(line, "0123456789") == (size_t) (tab - line)) {
+            text = tab + 1;
+        }
+        if (session_line_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            session_lines = (char **) realloc(session_lines, capacity * sizeof(char *));
+        }
+        session_lines[session_line_count++] = strdup(text);
+    }
+    fclose(file);
+    return 0;
+}
+
+static int is_prompt_end(const char *recent) {
+    // recent holds the last PROMPT_MARKER_SIZE characters outside of escape
+    // sequences
+    return memcmp(recent, "\n>> ", 4) == 0 || memcmp(recent, "\r>> ", 4) == 0
+           || memcmp(&recent[1], "\n> ", 3) == 0 || memcmp(&recent[1], "\r> ", 3) == 0;
+}
+
+static int wait_for_prompt(int master) {
+    // Reads terminal output until the next prompt has been drawn
+    // Returns -1 on timeout or when the shell has exited
+    char recent[PROMPT_MARKER_SIZE] = {0};
+    // 1 after ESC, 2 inside a CSI sequence such as a color
+    int escape = 0;
+    char buf[READ_BUF_SIZE];
+    long long deadline = now_us() + (long long) PROMPT_TIMEOUT_MS * 1000;
+    while (1) {
+        int remaining = (int) ((deadline - now_us()) / 1000);
+        if (remaining <= 0) {
+            fprintf(stderr, "replay: timed out waiting for a prompt\n");
+            return -1;
+        }
+        struct pollfd poll_fd = {master, POLLIN, 0};
+        if (poll(&poll_fd, 1, remaining) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+        if (!(poll_fd.revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+        ssize_t bytes = read(master, buf, sizeof(buf));
+        if (bytes <= 0) {
+            // EIO once the shell has closed the terminal
+            return -1;
+        }
+        // The window carries over between reads, in case the prompt was
+        // split across them
+        ssize_t k;
+        for (k = 0; k < bytes; ++k) {
+            unsigned char c = buf[k];
+            if (escape == 1) {
+                escape = (c == '[') ? 2 : 0;
+                continue;
+            }
+            if (escape == 2) {
+                // Parameters until the final byte
+                if (c >= 0x40 && c <= 0x7e) {
+                    escape = 0;
+                }
+                continue;
+            }
+            if (c == '\x1b') {
+                escape = 1;
+                continue;
+            }
+            memmove(recent, &recent[1], PROMPT_MARKER_SIZE - 1);
+            recent[PROMPT_MARKER_SIZE - 1] = c;
+            if (k == bytes - 1 && is_prompt_end(recent)) {
+                // Only once the shell has stopped writing, so ">> " in the
+                // output of a command isn't mistaken for the prompt
+                return 0;
+            }
+        }
+    }
+}
+
+static long long json_number(const char *event, const char *key) {
+    const char *found = strstr(event, key);
+    return found != NULL ? atoll(found + strlen(key)) : -1;
+}
+
+static void read_trace(const char *path, int shell_pid, struct samples *prompt,
+                       struct samples *parse, struct samples *execute) {
+    // Picks the phase spans out of the trace, one event per line
+    // Parse and execute spans from command substitutions and other children
+    // are left out, since they are already part of a top-level span
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return;
+    }
+    char *event = NULL;
+    size_t size = 0;
+    while (getline(&event, &size, file) > 0) {
+        long long dur = json_number(event, "\"dur\":");
+        long long pid = json_number(event, "\"pid\":");
+        if (dur < 0) {
+            continue;
+        }
+        if (strstr(event, "\"cat\":\"prompt\"") != NULL) {
+            add_sample(prompt, dur);
+        }
+        else if (pid == shell_pid && strstr(event, "\"cat\":\"parse\"") != NULL) {
+            add_sample(parse, dur);
+        }
+        else if (pid == shell_pid && strstr(event, "\"cat\":\"execute\"") != NULL) {
+            add_sample(execute, dur);
+        }
+    }
+    free(event);
+    fclose(file);
+}
+
+static int replay(const char *shell) {
+    char trace_path[] = "/tmp/ship_replay_XXXXXX";
+    int trace_file = mkstemp(trace_path);
+    if (trace_file < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+    close(trace_file);
+    struct winsize size = {TERMINAL_ROWS, TERMINAL_COLUMNS, 0, 0};
+    int master;
+    int pid = forkpty(&master, NULL, NULL, &size);
+    if (pid < 0) {
+        perror("forkpty");
+        unlink(trace_path);
+        return -1;
+    }
+    if (!pid) {
+        setenv("SHIP_TRACE", trace_path, 1);
+        unsetenv("SHIP_RECORD");
+        execl(shell, shell, (char *) NULL);
+        perror(shell);
+        _exit(127);
+    }
+    struct samples round_trip = {0};
+    struct samples prompt = {0};
+    struct samples parse = {0};
+    struct samples execute = {0};
+    int result = 0;
+    // Startup is measured by --startup-profile, not here
+    if (wait_for_prompt(master) < 0) {
+        result = -1;
+    }
+    size_t k;
+    for (k = 0; result == 0 && k < session_line_count; ++k) {
+        // Enter to the next prompt being drawn, as the user sees it
+        long long start = now_us();
+        if (write(master, session_lines[k], strlen(session_lines[k])) < 0 || write(master, "\r", 1) < 0) {
+            result = -1;
+            break;
+        }
+        if (wait_for_prompt(master) < 0) {
+            // The session may end with exit
+            break;
+        }
+        add_sample(&round_trip, now_us() - start);
+    }
+    write(master, "exit\r", 5);
+    char buf[READ_BUF_SIZE];
+    while (read(master, buf, sizeof(buf)) > 0);
+    close(master);
+    int status;
+    waitpid(pid, &status, 0);
+    read_trace(trace_path, pid, &prompt, &parse, &execute);
+    unlink(trace_path);
+    printf("%s\n", shell);
+    printf("  %-14s %8s %10s %10s %10s\n", "phase (us)", "samples", "p50", "p90", "p99");
+    print_samples("enter->prompt", &round_trip);
+    print_samples("prompt", &prompt);
+    print_samples("parse", &parse);
+    print_samples("execute", &execute);
+    free(round_trip.values);
+    free(prompt.values);
+    free(parse.values);
+    free(execute.values);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s session.log [shell...]\n", argv[0]);
+        return 2;
+    }
+    if (read_session(argv[1]) < 0) {
+        return 1;
+    }
+    // A recorded session may pipe into commands that exit early
+    signal(SIGPIPE, SIG_IGN);
+    int result = 0;
+    int k;
+    if (argc == 2) {
+        result = replay(DEFAULT_SHELL);
+    }
+    for (k = 2; k < argc; ++k) {
+        if (replay(argv[k]) < 0) {
+            result = 1;
+        }
+    }
+    return result;
+}
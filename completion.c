@@ -0,0 +1,505 @@
+#include "completion.h"
+#include "functions.h"
+#include "options.h"
+#include "stats.h"
+#include "parallel.h"
+
+struct path_dir_entry path_dirs[COMPLETION_MAX_PATH_DIRS];
+int path_dir_count = 0;
+char *indexed_path = NULL;
+// Sorted, deduplicated array of every executable on $PATH plus builtins
+char **command_index = NULL;
+size_t command_index_count = 0;
+// Set when a directory was rescanned and the merged index is stale
+char command_index_dirty = FALSE;
+struct dir_listing dir_listings[COMPLETION_DIR_CACHE_SIZE];
+unsigned long dir_listing_clock = 0;
+
+void init_completion() {
+#ifndef SHIP_NO_READLINE
+    rl_attempted_completion_function = ship_completion;
+#endif
+}
+
+static void add_defined_name(const char *name, void *value, void *data) {
+    char ***tail = (char ***) data;
+    *((*tail)++) = (char *) name;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+void refresh_command_index() {
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "";
+    }
+    // Rebuild the directory list only if $PATH itself changed
+    if (indexed_path == NULL || strcmp(indexed_path, path) != 0) {
+        free_command_index();
+        indexed_path = strdup(path);
+        char *path_copy = strdup(path);
+        char *saveptr;
+        char *dir = strtok_r(path_copy, ":", &saveptr);
+        while (dir != NULL && path_dir_count < COMPLETION_MAX_PATH_DIRS) {
+            path_dirs[path_dir_count].path = strdup(dir);
+            path_dirs[path_dir_count].mtime.tv_sec = -1;
+            path_dirs[path_dir_count].mtime.tv_nsec = 0;
+            path_dirs[path_dir_count].names = NULL;
+            path_dirs[path_dir_count].count = 0;
+            ++path_dir_count;
+            dir = strtok_r(NULL, ":", &saveptr);
+        }
+        free(path_copy);
+        command_index_dirty = TRUE;
+    }
+    // Only rescan the directories that changed since the last scan
+    int i;
+    for (i = 0; i < path_dir_count; ++i) {
+        struct stat dir_stat;
+        if (stat(path_dirs[i].path, &dir_stat) < 0) {
+            if (path_dirs[i].count != 0 || path_dirs[i].mtime.tv_sec != 0) {
+                // Directory disappeared, so forget its contents
+                rescan_path_dir(&path_dirs[i]);
+                path_dirs[i].mtime.tv_sec = 0;
+                command_index_dirty = TRUE;
+            }
+            continue;
+        }
+        if (dir_stat.st_mtim.tv_sec != path_dirs[i].mtime.tv_sec
+            || dir_stat.st_mtim.tv_nsec != path_dirs[i].mtime.tv_nsec) {
+            path_dirs[i].mtime = dir_stat.st_mtim;
+            rescan_path_dir(&path_dirs[i]);
+            command_index_dirty = TRUE;
+        }
+    }
+    if (command_index_dirty) {
+        rebuild_command_index();
+    }
+}
+
+void rescan_path_dir(struct path_dir_entry *dir) {
+    size_t j;
+    for (j = 0; j < dir->count; ++j) {
+        free(dir->names[j]);
+    }
+    free(dir->names);
+    dir->names = NULL;
+    dir->count = 0;
+    DIR *dir_stream = opendir(dir->path);
+    if (dir_stream == NULL) {
+        return;
+    }
+    int dir_fd = dirfd(dir_stream);
+    size_t capacity = COMPLETION_INITIAL_CAPACITY;
+    dir->names = (char **) malloc(capacity * sizeof(char *));
+    struct dirent *entry;
+    while ((entry = readdir(dir_stream)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        // Skip anything that obviously can't be executed without a stat
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        if (faccessat(dir_fd, entry->d_name, X_OK, 0) < 0) {
+            continue;
+        }
+        if (dir->count == capacity) {
+            capacity *= 2;
+            dir->names = (char **) realloc(dir->names, capacity * sizeof(char *));
+        }
+        dir->names[dir->count++] = strdup(entry->d_name);
+    }
+    closedir(dir_stream);
+}
+
+void rebuild_command_index() {
+    free(command_index);
+    size_t total = 0;
+    int i;
+    for (i = 0; i < path_dir_count; ++i) {
+        total += path_dirs[i].count;
+    }
+    const char *builtins[MAX_BUILTINS];
+    size_t builtin_count = get_builtin_names(builtins);
+    total += builtin_count + functions->count + aliases->count;
+    // The index only borrows the names owned by path_dirs, the builtins,
+    // and the function and alias tables
+    command_index = (char **) malloc((total + 1) * sizeof(char *));
+    size_t count = 0;
+    size_t j;
+    for (j = 0; j < builtin_count; ++j) {
+        command_index[count++] = (char *) builtins[j];
+    }
+    char **tail = &command_index[count];
+    hash_table_foreach(functions, add_defined_name, &tail);
+    hash_table_foreach(aliases, add_defined_name, &tail);
+    count = tail - command_index;
+    for (i = 0; i < path_dir_count; ++i) {
+        for (j = 0; j < path_dirs[i].count; ++j) {
+            command_index[count++] = path_dirs[i].names[j];
+        }
+    }
+    qsort(command_index, count, sizeof(char *), compare_names);
+    // Remove duplicates (the same command in several $PATH directories)
+    size_t unique = 0;
+    for (j = 0; j < count; ++j) {
+        if (unique == 0 || strcmp(command_index[unique - 1], command_index[j]) != 0) {
+            command_index[unique++] = command_index[j];
+        }
+    }
+    command_index[unique] = NULL;
+    command_index_count = unique;
+    command_index_dirty = FALSE;
+}
+
+void free_command_index() {
+    int i;
+    size_t j;
+    for (i = 0; i < path_dir_count; ++i) {
+        for (j = 0; j < path_dirs[i].count; ++j) {
+            free(path_dirs[i].names[j]);
+        }
+        free(path_dirs[i].names);
+        free(path_dirs[i].path);
+    }
+    path_dir_count = 0;
+    free(command_index);
+    command_index = NULL;
+    command_index_count = 0;
+    free(indexed_path);
+    indexed_path = NULL;
+}
+
+char *command_generator(const char *text, int state) {
+    static size_t match_index;
+    static size_t text_len;
+    if (!state) {
+        // Binary search for the first entry >= text
+        size_t low = 0;
+        size_t high = command_index_count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (strcmp(command_index[mid], text) < 0) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+        match_index = low;
+        text_len = strlen(text);
+    }
+    // Matches are contiguous in the sorted index
+    if (match_index < command_index_count && strncmp(command_index[match_index], text, text_len) == 0) {
+        return strdup(command_index[match_index++]);
+    }
+    return NULL;
+}
+
+static int compare_listing_names(const void *a, const void *b, void *names) {
+    return strcmp((char *) names + *(const size_t *) a, (char *) names + *(const size_t *) b);
+}
+
+static int is_filename_candidate(const char *name, const char *prefix, size_t prefix_length) {
+    // Hidden files are only offered once the prefix starts with a dot
+    return strncmp(name, prefix, prefix_length) == 0 && (name[0] != '.' || prefix[0] == '.');
+}
+
+static void add_listing_name(struct dir_listing *listing, const char *name, size_t length) {
+    if (listing->names_length + length + 1 > listing->names_capacity) {
+        listing->names_capacity = (listing->names_capacity + length + 1) * 2;
+        listing->names = (char *) realloc(listing->names, listing->names_capacity * sizeof(char));
+    }
+    if (listing->count == listing->capacity) {
+        listing->capacity = listing->capacity ? listing->capacity * 2 : COMPLETION_INITIAL_CAPACITY;
+        listing->offsets = (size_t *) realloc(listing->offsets, listing->capacity * sizeof(size_t));
+    }
+    listing->offsets[listing->count++] = listing->names_length;
+    memcpy(&listing->names[listing->names_length], name, length + 1);
+    listing->names_length += length + 1;
+}
+
+int stream_dir_listing(struct dir_listing *listing, const char *prefix, size_t limit) {
+    // Reads the directory with getdents64(), counting the names that start
+    // with prefix as they arrive and stopping once there are limit of them,
+    // so a huge directory doesn't hold up the prompt
+    // Returns -1 with errno set if the directory can't be read
+    static char buffer[COMPLETION_GETDENTS_SIZE] __attribute__((aligned(__alignof__(struct dirent64))));
+    listing->names_length = 0;
+    listing->count = 0;
+    listing->complete = FALSE;
+    int fd = open(listing->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t prefix_length = strlen(prefix);
+    size_t candidates = 0;
+    ssize_t bytes = 0;
+    while (candidates < limit && (bytes = getdents64(fd, buffer, sizeof(buffer))) > 0) {
+        ssize_t k = 0;
+        while (k < bytes) {
+            struct dirent64 *entry = (struct dirent64 *) &buffer[k];
+            k += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            add_listing_name(listing, entry->d_name, strlen(entry->d_name));
+            if (is_filename_candidate(entry->d_name, prefix, prefix_length)) {
+                ++candidates;
+            }
+        }
+    }
+    listing->complete = (candidates < limit && bytes == 0);
+    close(fd);
+    qsort_r(listing->offsets, listing->count, sizeof(size_t), compare_listing_names, listing->names);
+    return 0;
+}
+
+static struct dir_listing *find_dir_listing_slot(const char *path) {
+    // Returns the slot holding path, or the least recently used one
+    struct dir_listing *listing = NULL;
+    int k;
+    for (k = 0; k < COMPLETION_DIR_CACHE_SIZE; ++k) {
+        if (dir_listings[k].path != NULL && strcmp(dir_listings[k].path, path) == 0) {
+            listing = &dir_listings[k];
+            break;
+        }
+        if (listing == NULL || dir_listings[k].last_used < listing->last_used) {
+            listing = &dir_listings[k];
+        }
+    }
+    listing->last_used = ++dir_listing_clock;
+    if (listing->path == NULL || strcmp(listing->path, path) != 0) {
+        free(listing->path);
+        listing->path = strdup(path);
+        listing->complete = FALSE;
+    }
+    return listing;
+}
+
+struct dir_listing *get_dir_listing(const char *path, const char *prefix, size_t limit) {
+    // Returns the cached listing of path if the directory hasn't changed
+    // since it was read in full, or reads it again into the least recently
+    // used slot
+    // Returns NULL if the directory can't be read
+    struct stat info;
+    if (stat(path, &info) < 0 || !S_ISDIR(info.st_mode)) {
+        return NULL;
+    }
+    struct dir_listing *listing = find_dir_listing_slot(path);
+    COUNT_STAT(STAT_COMPLETION_LOOKUPS, 1);
+    if (listing->complete && listing->device == info.st_dev && listing->inode == info.st_ino
+        && listing->mtime.tv_sec == info.st_mtim.tv_sec && listing->mtime.tv_nsec == info.st_mtim.tv_nsec) {
+        COUNT_STAT(STAT_COMPLETION_HITS, 1);
+        return listing;
+    }
+    listing->mtime = info.st_mtim;
+    listing->device = info.st_dev;
+    listing->inode = info.st_ino;
+    if (stream_dir_listing(listing, prefix, limit) < 0) {
+        free(listing->path);
+        listing->path = NULL;
+        return NULL;
+    }
+    listing->fresh = TRUE;
+    return listing;
+}
+
+void save_dir_listings(int fd) {
+    // Called in the readline process once the line is read, since the
+    // process, and with it anything it read, is gone by the next prompt
+    int k;
+    for (k = 0; k < COMPLETION_DIR_CACHE_SIZE; ++k) {
+        struct dir_listing *listing = &dir_listings[k];
+        // A cut-off listing would be read again anyway
+        if (listing->path == NULL || !listing->fresh || !listing->complete) {
+            continue;
+        }
+        struct dir_listing_record record = {strlen(listing->path), listing->mtime, listing->device,
+                                            listing->inode, listing->names_length, listing->count};
+        write_all(fd, (char *) &record, sizeof(record));
+        write_all(fd, listing->path, record.path_length);
+        write_all(fd, listing->names, listing->names_length);
+        write_all(fd, (char *) listing->offsets, listing->count * sizeof(size_t));
+    }
+}
+
+void load_dir_listings(int fd) {
+    // Called in the shell after the readline process exits, taking over the
+    // listings it saved to fd and leaving fd empty for the next one
+    struct stat info;
+    char *data = NULL;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = (char *) malloc(info.st_size * sizeof(char));
+        if (pread(fd, data, info.st_size, 0) != info.st_size) {
+            // A record cut short by a failed write; keep what the shell has
+            info.st_size = 0;
+        }
+    }
+    size_t size = (data != NULL) ? (size_t) info.st_size : 0;
+    size_t index = 0;
+    struct dir_listing_record record;
+    while (size - index >= sizeof(record)) {
+        memcpy(&record, &data[index], sizeof(record));
+        index += sizeof(record);
+        if (size - index < record.path_length + record.names_length + record.count * sizeof(size_t)) {
+            break;
+        }
+        char *path = strndup(&data[index], record.path_length);
+        index += record.path_length;
+        struct dir_listing *listing = find_dir_listing_slot(path);
+        free(path);
+        if (record.names_length > listing->names_capacity) {
+            listing->names_capacity = record.names_length;
+            listing->names = (char *) realloc(listing->names, listing->names_capacity * sizeof(char));
+        }
+        if (record.count > listing->capacity) {
+            listing->capacity = record.count;
+            listing->offsets = (size_t *) realloc(listing->offsets, listing->capacity * sizeof(size_t));
+        }
+        memcpy(listing->names, &data[index], record.names_length);
+        index += record.names_length;
+        memcpy(listing->offsets, &data[index], record.count * sizeof(size_t));
+        index += record.count * sizeof(size_t);
+        listing->names_length = record.names_length;
+        listing->count = record.count;
+        listing->mtime = record.mtime;
+        listing->device = record.device;
+        listing->inode = record.inode;
+        listing->complete = TRUE;
+        listing->fresh = FALSE;
+    }
+    free(data);
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        print_error();
+    }
+}
+
+char **complete_filename(const char *text) {
+    // Completes the file name in text, returning matches the way
+    // rl_completion_matches() does: the text to insert, then the candidates
+    // Only the first completion_limit candidates are offered, in which case
+    // nothing is inserted, as their common prefix may not be everyone's
+    const char *slash = strrchr(text, '/');
+    size_t dir_length = (slash != NULL) ? (size_t) (slash - text) + 1 : 0;
+    const char *prefix = &text[dir_length];
+    char path[COMPLETION_PATH_MAX_SIZE];
+    if (dir_length == 0) {
+        strcpy(path, ".");
+    }
+    else if (text[0] == '~') {
+        // Only ~/, since ship_completion() leaves ~user to readline
+        if (snprintf(path, sizeof(path), "%s%.*s", home, (int) dir_length - 1, &text[1]) >= (int) sizeof(path)) {
+            return NULL;
+        }
+    }
+    else if (dir_length < sizeof(path)) {
+        memcpy(path, text, dir_length);
+        path[dir_length] = '\0';
+    }
+    else {
+        return NULL;
+    }
+    long option = get_option(OPT_COMPLETION_LIMIT);
+    size_t limit = (option > 0) ? (size_t) option : SIZE_MAX;
+    struct dir_listing *listing = get_dir_listing(path, prefix, limit);
+    if (listing == NULL) {
+        return NULL;
+    }
+    // Binary search for the first name >= prefix; candidates are contiguous
+    size_t low = 0;
+    size_t high = listing->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(&listing->names[listing->offsets[mid]], prefix) < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    size_t prefix_length = strlen(prefix);
+    size_t count = 0;
+    char **matches = NULL;
+    char truncated = !listing->complete;
+    const char *first = NULL;
+    const char *last = NULL;
+    size_t j;
+    for (j = low; j < listing->count; ++j) {
+        const char *name = &listing->names[listing->offsets[j]];
+        if (strncmp(name, prefix, prefix_length) != 0) {
+            break;
+        }
+        if (!is_filename_candidate(name, prefix, prefix_length)) {
+            continue;
+        }
+        if (count == limit) {
+            truncated = TRUE;
+            break;
+        }
+        if (count % COMPLETION_INITIAL_CAPACITY == 0) {
+            matches = (char **) realloc(matches, (count + COMPLETION_INITIAL_CAPACITY + 2) * sizeof(char *));
+        }
+        size_t length = strlen(name);
+        char *match = (char *) malloc((dir_length + length + 1) * sizeof(char));
+        memcpy(match, text, dir_length);
+        memcpy(&match[dir_length], name, length + 1);
+        matches[++count] = match;
+        first = (first == NULL) ? name : first;
+        last = name;
+    }
+    if (count == 0) {
+        return NULL;
+    }
+    matches[count + 1] = NULL;
+    if (count == 1 && !truncated) {
+        matches[0] = matches[1];
+        matches[1] = NULL;
+        return matches;
+    }
+    // The names are sorted, so the first and last share the common prefix
+    size_t common = 0;
+    while (!truncated && first[common] != '\0' && first[common] == last[common]) {
+        ++common;
+    }
+    if (truncated) {
+        common = prefix_length;
+    }
+    matches[0] = (char *) malloc((dir_length + common + 1) * sizeof(char));
+    memcpy(matches[0], text, dir_length);
+    memcpy(&matches[0][dir_length], first, common);
+    matches[0][dir_length + common] = '\0';
+    return matches;
+}
+
+#ifndef SHIP_NO_READLINE
+int is_command_position(int start) {
+    // The word being completed is a command if only whitespace separates it
+    // from the start of the line or from a command separator
+    int index = start - 1;
+    while (index >= 0 && (rl_line_buffer[index] == ' ' || rl_line_buffer[index] == '\t')) {
+        --index;
+    }
+    return index < 0 || strchr(";|`(&", rl_line_buffer[index]) != NULL;
+}
+
+char **ship_completion(const char *text, int start, int end) {
+    if (command_index != NULL && is_command_position(start) && strchr(text, '/') == NULL) {
+        // Don't fall back to filename completion for command names
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, command_generator);
+    }
+    if (text[0] == '~' && strchr(text, '/') == NULL) {
+        // Let readline complete ~user
+        return NULL;
+    }
+    rl_attempted_completion_over = 1;
+    // Readline appends / to directories and lists only the last part of
+    // each path
+    rl_filename_completion_desired = 1;
+    return complete_filename(text);
+}
+#endif
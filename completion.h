@@ -0,0 +1,75 @@
+#pragma once
+#include "shell.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+
+// Constants
+#define COMPLETION_MAX_PATH_DIRS 64
+#define COMPLETION_INITIAL_CAPACITY 256
+// Directories whose listings are kept for filename completion
+#define COMPLETION_DIR_CACHE_SIZE 8
+#define COMPLETION_GETDENTS_SIZE 65536
+#define COMPLETION_PATH_MAX_SIZE 4096
+
+// A directory on $PATH along with the executables found in it the last
+// time it was scanned
+struct path_dir_entry {
+    char *path;
+    struct timespec mtime;
+    char **names;
+    size_t count;
+};
+
+// The names in a directory, sorted, for filename completion; kept by the
+// shell across prompts until the directory's mtime changes
+// The names are stored back to back in one buffer, which is reused along
+// with the offsets when the listing is read again
+struct dir_listing {
+    char *path;
+    struct timespec mtime;
+    char *names;
+    size_t names_length;
+    size_t names_capacity;
+    size_t *offsets;
+    size_t count;
+    size_t capacity;
+    // Identifies the directory itself, since "." depends on the cwd
+    dev_t device;
+    ino_t inode;
+    // Every name was read, rather than stopping at the candidate limit
+    char complete;
+    // Read by this readline process, so not yet handed back to the shell
+    char fresh;
+    unsigned long last_used;
+};
+
+// Written ahead of each listing handed back by the readline process,
+// followed by its path, its names, and its offsets
+struct dir_listing_record {
+    size_t path_length;
+    struct timespec mtime;
+    dev_t device;
+    ino_t inode;
+    size_t names_length;
+    size_t count;
+};
+
+// Function type signatures
+void init_completion();
+void refresh_command_index();
+void rescan_path_dir(struct path_dir_entry *dir);
+void rebuild_command_index();
+void free_command_index();
+char *command_generator(const char *text, int state);
+struct dir_listing *get_dir_listing(const char *path, const char *prefix, size_t limit);
+int stream_dir_listing(struct dir_listing *listing, const char *prefix, size_t limit);
+void save_dir_listings(int fd);
+void load_dir_listings(int fd);
+char **complete_filename(const char *text);
+char **ship_completion(const char *text, int start, int end);
+int is_command_position(int start);
+
+// Variables
+extern char command_index_dirty;
@@ -0,0 +1,143 @@
+#include "coproc.h"
+#include "variables.h"
+#include "functions.h"
+#include "stats.h"
+
+static void set_coprocess_var(const char *name, const char *suffix, long value) {
+    char var[COPROCESS_NAME_MAX_SIZE + 8];
+    char text[32];
+    snprintf(var, sizeof(var), "%s%s", name, suffix);
+    snprintf(text, sizeof(text), "%ld", value);
+    set_var(var, text);
+}
+
+void set_coprocess_vars(struct coprocess *coprocess) {
+    // NAME_IN is written to with >&$NAME_IN and NAME_OUT read from with
+    // <&$NAME_OUT
+    set_coprocess_var(coprocess->name, COPROCESS_IN_SUFFIX, coprocess->in_fd);
+    set_coprocess_var(coprocess->name, COPROCESS_OUT_SUFFIX, coprocess->out_fd);
+    set_coprocess_var(coprocess->name, COPROCESS_PID_SUFFIX, coprocess->pid);
+}
+
+void unset_coprocess_vars(const char *name) {
+    const char *suffixes[] = {COPROCESS_IN_SUFFIX, COPROCESS_OUT_SUFFIX, COPROCESS_PID_SUFFIX};
+    char var[COPROCESS_NAME_MAX_SIZE + 8];
+    size_t k;
+    for (k = 0; k < sizeof(suffixes) / sizeof(suffixes[0]); ++k) {
+        snprintf(var, sizeof(var), "%s%s", name, suffixes[k]);
+        unset_var(var);
+    }
+}
+
+int start_coprocess(const char *name, char **argv) {
+    // Starts argv with a pipe to its stdin and one from its stdout
+    // The shell's ends are close-on-exec, so no other child holds them open
+    // and the coprocess sees EOF once they are closed
+    // Returns -1 with errno set on failure
+    int to_child[2];
+    int from_child[2];
+    COUNT_STAT(STAT_PIPES, 1);
+    if (pipe2(to_child, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    COUNT_STAT(STAT_PIPES, 1);
+    if (pipe2(from_child, O_CLOEXEC) < 0) {
+        int error = errno;
+        close(to_child[0]);
+        close(to_child[1]);
+        errno = error;
+        return -1;
+    }
+    int pid = spawn_command_fds(argv, to_child[0], from_child[1]);
+    int error = errno;
+    close(to_child[0]);
+    close(from_child[1]);
+    // Not the shell's foreground command
+    child_pid = 0;
+    if (pid < 0) {
+        close(to_child[1]);
+        close(from_child[0]);
+        errno = error;
+        return -1;
+    }
+    struct coprocess *coprocess = add_coprocess(name, pid, to_child[1], from_child[0]);
+    if (coprocess == NULL) {
+        // spawn_command_fds() succeeded, so stop what it started
+        close(to_child[1]);
+        close(from_child[0]);
+        kill(pid, SIGTERM);
+        wait_for_children(&pid, &error, 1);
+        errno = EMFILE;
+        return -1;
+    }
+    set_coprocess_vars(coprocess);
+    return 0;
+}
+
+void print_coprocesses() {
+    reap_coprocesses();
+    int k;
+    for (k = 0; k < coprocess_count; ++k) {
+        struct coprocess *coprocess = &coprocesses[k];
+        printf("%-16s pid %-8d in %-4d out %-4d ", coprocess->name, coprocess->pid, coprocess->in_fd, coprocess->out_fd);
+        if (coprocess->running) {
+            printf("running\n");
+        }
+        else if (WIFEXITED(coprocess->status)) {
+            printf("exited %d\n", WEXITSTATUS(coprocess->status));
+        }
+        else {
+            printf("killed by signal %d\n", WTERMSIG(coprocess->status));
+        }
+    }
+}
+
+void coproc_builtin(char **args, int count) {
+    // coproc NAME command [args...] starts a coprocess
+    // coproc -c NAME closes its pipes and waits for it; $? is its status
+    // coproc lists them
+    const char *error = NULL;
+    if (count == 0) {
+        print_coprocesses();
+        return;
+    }
+    if (strcmp(args[0], "-c") == 0) {
+        struct coprocess *coprocess = (count == 2) ? find_coprocess(args[1]) : NULL;
+        if (coprocess == NULL) {
+            fprintf(stderr, "[Error]: coproc: %s: no such coprocess\n", count == 2 ? args[1] : "");
+            cmd_exit_status = 1;
+            cmd_error = CMD_ERROR;
+            return;
+        }
+        close_coprocess(coprocess);
+        unset_coprocess_vars(coprocess->name);
+        int status = coprocess->status;
+        remove_coprocess(coprocess);
+        record_wait_status(status);
+        return;
+    }
+    if (count < 2) {
+        error = "usage: coproc NAME command [args...] | coproc -c NAME";
+    }
+    else if (var_name_length(args[0]) != strlen(args[0]) || strlen(args[0]) >= COPROCESS_NAME_MAX_SIZE) {
+        error = "invalid name";
+    }
+    else if (find_coprocess(args[0]) != NULL) {
+        error = "already running (close it with coproc -c)";
+    }
+    // It has to be a program, which outlives the command that started it
+    else if (is_builtin(args[1]) || find_function(args[1]) != NULL) {
+        error = "cannot run a built-in or function as a coprocess";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: coproc: %s\n", error);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (start_coprocess(args[0], &args[1]) < 0) {
+        print_error();
+        cmd_exit_status = (errno == ENOENT) ? EXEC_NOT_FOUND_EXIT_CODE : EXEC_FAIL_EXIT_CODE;
+        cmd_error = CMD_ERROR;
+    }
+}
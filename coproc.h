@@ -0,0 +1,16 @@
+#pragma once
+#include "shell.h"
+#include "process.h"
+
+// Constants
+// Variables set for coprocess NAME
+#define COPROCESS_IN_SUFFIX "_IN"
+#define COPROCESS_OUT_SUFFIX "_OUT"
+#define COPROCESS_PID_SUFFIX "_PID"
+
+// Function type signatures
+void coproc_builtin(char **args, int count);
+int start_coprocess(const char *name, char **argv);
+void set_coprocess_vars(struct coprocess *coprocess);
+void unset_coprocess_vars(const char *name);
+void print_coprocesses();
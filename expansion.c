@@ -0,0 +1,395 @@
+#include "expansion.h"
+#include "variables.h"
+#include <stdint.h>
+
+static size_t scan_parameter_word(const char *text, const char *stops) {
+    // Returns the index of the first } or stop character outside of quotes,
+    // escapes and nested ${...}, or SIZE_MAX if the word is not closed
+    size_t k = 0;
+    char quote = '\0';
+    while (text[k] != '\0') {
+        if (quote != '\0') {
+            if (text[k] == quote) {
+                quote = '\0';
+            }
+            else if (text[k] == '\\' && quote == '"' && text[k + 1] != '\0') {
+                ++k;
+            }
+        }
+        else if (text[k] == '\\' && text[k + 1] != '\0') {
+            ++k;
+        }
+        else if (text[k] == '\'' || text[k] == '"') {
+            quote = text[k];
+        }
+        else if (text[k] == '$' && text[k + 1] == '{') {
+            size_t nested = scan_parameter_word(&text[k + 2], "");
+            if (nested == SIZE_MAX) {
+                return SIZE_MAX;
+            }
+            k += 2 + nested;
+        }
+        else if (text[k] == '}' || strchr(stops, text[k]) != NULL) {
+            return k;
+        }
+        ++k;
+    }
+    return SIZE_MAX;
+}
+
+size_t parse_parameter_operator(const char *text, struct parameter_operator *op) {
+    // Parses the operator of the ${...} starting at text (just after the {)
+    // Returns the length up to and including the closing }, or 0 if it is
+    // not a supported operator
+    memset(op, 0, sizeof(*op));
+    size_t k = 0;
+    if (text[0] == '#' && text[1] != '}') {
+        // ${#} on its own is the number of positional parameters
+        op->kind = PARAMETER_LENGTH;
+        k = 1;
+    }
+    op->name = &text[k];
+    op->name_length = special_param_length(op->name, TRUE);
+    if (op->name_length == 0) {
+        op->name_length = var_name_length(op->name);
+    }
+    if (op->name_length == 0) {
+        return 0;
+    }
+    k += op->name_length;
+    if (op->kind == PARAMETER_LENGTH) {
+        return (text[k] == '}') ? k + 1 : 0;
+    }
+    if (text[k] == ':' && (text[k + 1] == '-' || text[k + 1] == '=')) {
+        op->colon = TRUE;
+        ++k;
+    }
+    const char *stops = "";
+    switch (text[k]) {
+        case '-':
+            op->kind = PARAMETER_DEFAULT;
+            break;
+        case '=':
+            op->kind = PARAMETER_ASSIGN;
+            break;
+        case '#':
+        case '%':
+            op->kind = (text[k] == '#') ? PARAMETER_TRIM_PREFIX : PARAMETER_TRIM_SUFFIX;
+            if (text[k + 1] == text[k]) {
+                op->longest = TRUE;
+                ++k;
+            }
+            break;
+        case '/':
+            op->kind = PARAMETER_REPLACE;
+            if (text[k + 1] == '/') {
+                op->all = TRUE;
+                ++k;
+            }
+            else if (text[k + 1] == '#' || text[k + 1] == '%') {
+                op->anchor = (text[k + 1] == '#') ? PARAMETER_ANCHOR_START : PARAMETER_ANCHOR_END;
+                ++k;
+            }
+            stops = "/";
+            break;
+        case ':':
+            op->kind = PARAMETER_SUBSTRING;
+            stops = ":";
+            break;
+        default:
+            return 0;
+    }
+    ++k;
+    size_t length = scan_parameter_word(&text[k], stops);
+    if (length == SIZE_MAX) {
+        return 0;
+    }
+    op->word = &text[k];
+    op->word_length = length;
+    k += length;
+    if (text[k] != '}') {
+        // The replacement or substring length follows the second / or :
+        ++k;
+        length = scan_parameter_word(&text[k], "");
+        if (length == SIZE_MAX) {
+            return 0;
+        }
+        op->second = &text[k];
+        op->second_length = length;
+        op->has_second = TRUE;
+        k += length;
+    }
+    return k + 1;
+}
+
+size_t expand_parameter_word(const char *text, size_t length, char *buffer, size_t size, char pattern) {
+    // Expands the variables in a word of an operator and removes its quotes,
+    // leaving it NUL-terminated in buffer
+    // In a pattern, quoted and escaped characters keep a \ so they are
+    // matched literally
+    // Returns the length, or SIZE_MAX if it doesn't fit or uses a nested
+    // operator
+    size_t out = 0;
+    char quote = '\0';
+    size_t k;
+    for (k = 0; k < length; ++k) {
+        char c = text[k];
+        const char *value = NULL;
+        size_t value_length = 0;
+        if (c == '\\' && quote != '\'' && k + 1 < length) {
+            c = text[++k];
+            if (pattern) {
+                if (out + 2 >= size) {
+                    return SIZE_MAX;
+                }
+                buffer[out++] = '\\';
+                buffer[out++] = c;
+                continue;
+            }
+        }
+        else if ((c == '\'' || c == '"') && (quote == '\0' || quote == c)) {
+            quote = quote ? '\0' : c;
+            continue;
+        }
+        else if (c == '$' && quote != '\'') {
+            int braced = (text[k + 1] == '{');
+            const char *name = &text[k + 1 + braced];
+            size_t name_length = special_param_length(name, braced);
+            if (name_length == 0) {
+                name_length = var_name_length(name);
+            }
+            if (name_length > 0) {
+                if (braced && name[name_length] != '}') {
+                    return SIZE_MAX;
+                }
+                k += name_length + 2 * braced;
+                value = get_var_n(name, name_length);
+                if (value == NULL) {
+                    continue;
+                }
+                value_length = strlen(value);
+            }
+        }
+        if (value == NULL) {
+            value = &c;
+            value_length = 1;
+        }
+        size_t j;
+        for (j = 0; j < value_length; ++j) {
+            int escape = pattern && quote != '\0' && strchr("*?[\\", value[j]) != NULL;
+            if (out + 1 + escape >= size) {
+                return SIZE_MAX;
+            }
+            if (escape) {
+                buffer[out++] = '\\';
+            }
+            buffer[out++] = value[j];
+        }
+    }
+    buffer[out] = '\0';
+    return out;
+}
+
+static int match_glob_element(const char *pattern, size_t length, size_t *index, char c) {
+    // Matches c against the ?, [...], \x, or plain character at *index,
+    // moving *index past it
+    size_t k = *index;
+    if (pattern[k] == '\\' && k + 1 < length) {
+        *index = k + 2;
+        return pattern[k + 1] == c;
+    }
+    if (pattern[k] == '?') {
+        *index = k + 1;
+        return TRUE;
+    }
+    if (pattern[k] == '[') {
+        size_t j = k + 1;
+        int negate = (j < length && (pattern[j] == '!' || pattern[j] == '^'));
+        j += negate;
+        size_t first = j;
+        int matched = FALSE;
+        // A ] right after the [ is part of the set
+        while (j < length && (pattern[j] != ']' || j == first)) {
+            unsigned char low = pattern[j];
+            if (low == '\\' && j + 1 < length) {
+                low = pattern[++j];
+            }
+            unsigned char high = low;
+            if (j + 2 < length && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                high = pattern[j + 2];
+                j += 2;
+            }
+            if ((unsigned char) c >= low && (unsigned char) c <= high) {
+                matched = TRUE;
+            }
+            ++j;
+        }
+        if (j < length) {
+            *index = j + 1;
+            return matched != negate;
+        }
+        // Without a closing ], the [ is an ordinary character
+    }
+    *index = k + 1;
+    return pattern[k] == c;
+}
+
+int glob_match(const char *pattern, size_t pattern_length, const char *text, size_t text_length) {
+    // Returns TRUE if the whole of text matches the glob pattern
+    // Neither needs to be NUL-terminated, so slices of a value are matched in
+    // place
+    size_t p = 0;
+    size_t t = 0;
+    // Where to resume after the last *, which is all that needs
+    // backtracking
+    size_t star = SIZE_MAX;
+    size_t star_text = 0;
+    while (t < text_length) {
+        if (p < pattern_length && pattern[p] == '*') {
+            star = ++p;
+            star_text = t;
+            continue;
+        }
+        size_t next = p;
+        if (p < pattern_length && match_glob_element(pattern, pattern_length, &next, text[t])) {
+            p = next;
+            ++t;
+            continue;
+        }
+        if (star == SIZE_MAX) {
+            return FALSE;
+        }
+        p = star;
+        t = ++star_text;
+    }
+    while (p < pattern_length && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern_length;
+}
+
+static int is_literal_pattern(const char *pattern, size_t length) {
+    size_t k;
+    for (k = 0; k < length; ++k) {
+        if (strchr("*?[\\", pattern[k]) != NULL) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+size_t trim_parameter(const char *value, size_t length, const char *pattern, size_t pattern_length, int suffix, int longest, size_t *start) {
+    // Removes the shortest (or longest) prefix or suffix matching pattern
+    // Returns the length of what is left, which starts at *start
+    *start = 0;
+    if (is_literal_pattern(pattern, pattern_length)) {
+        if (pattern_length > length) {
+            return length;
+        }
+        if (!suffix && memcmp(value, pattern, pattern_length) == 0) {
+            *start = pattern_length;
+            return length - pattern_length;
+        }
+        if (suffix && memcmp(&value[length - pattern_length], pattern, pattern_length) == 0) {
+            return length - pattern_length;
+        }
+        return length;
+    }
+    size_t k;
+    for (k = 0; k <= length; ++k) {
+        size_t cut = longest ? length - k : k;
+        if (suffix ? glob_match(pattern, pattern_length, &value[length - cut], cut)
+                   : glob_match(pattern, pattern_length, value, cut)) {
+            if (!suffix) {
+                *start = cut;
+            }
+            return length - cut;
+        }
+    }
+    return length;
+}
+
+int find_parameter_pattern(const char *value, size_t length, size_t from, const char *pattern, size_t pattern_length, int anchor, size_t *start, size_t *end) {
+    // Finds the first (and longest) match of pattern at or after from
+    // Returns TRUE if there is one, between *start and *end
+    // Only an anchored pattern may be empty, to prepend or append
+    if (anchor == PARAMETER_ANCHOR_START && from > 0) {
+        return FALSE;
+    }
+    if (pattern_length == 0) {
+        *start = *end = (anchor == PARAMETER_ANCHOR_END) ? length : 0;
+        return anchor != PARAMETER_ANCHOR_NONE;
+    }
+    if (is_literal_pattern(pattern, pattern_length)) {
+        if (pattern_length > length - from) {
+            return FALSE;
+        }
+        const char *match;
+        if (anchor == PARAMETER_ANCHOR_NONE) {
+            match = (const char *) memmem(&value[from], length - from, pattern, pattern_length);
+        }
+        else {
+            match = (anchor == PARAMETER_ANCHOR_START) ? value : &value[length - pattern_length];
+            if (memcmp(match, pattern, pattern_length) != 0) {
+                match = NULL;
+            }
+        }
+        if (match == NULL) {
+            return FALSE;
+        }
+        *start = match - value;
+        *end = *start + pattern_length;
+        return TRUE;
+    }
+    size_t s;
+    for (s = from; s < length; ++s) {
+        size_t e;
+        for (e = length; e > s; --e) {
+            if (glob_match(pattern, pattern_length, &value[s], e - s)) {
+                *start = s;
+                *end = e;
+                return TRUE;
+            }
+            if (anchor == PARAMETER_ANCHOR_END) {
+                break;
+            }
+        }
+        if (anchor == PARAMETER_ANCHOR_START) {
+            break;
+        }
+    }
+    return FALSE;
+}
+
+int substring_bounds(size_t length, const char *offset, const char *count, size_t *start, size_t *end) {
+    // Works out ${NAME:OFFSET:COUNT}; a negative OFFSET counts from the end,
+    // and a negative COUNT leaves that many characters off the end
+    // Returns -1 if OFFSET or COUNT is not a number
+    char *rest;
+    long value = strtol(offset, &rest, 10);
+    if (rest == offset || rest[strspn(rest, " \t")] != '\0') {
+        return -1;
+    }
+    if (value < 0) {
+        value += length;
+    }
+    if (value < 0 || (size_t) value > length) {
+        // Past either end, which expands to nothing
+        value = length;
+    }
+    *start = value;
+    *end = length;
+    if (count != NULL) {
+        value = strtol(count, &rest, 10);
+        if (rest == count || rest[strspn(rest, " \t")] != '\0') {
+            return -1;
+        }
+        if (value < 0) {
+            *end = ((long) length + value > (long) *start) ? length + value : *start;
+        }
+        else if ((size_t) value < length - *start) {
+            *end = *start + value;
+        }
+    }
+    return 0;
+}
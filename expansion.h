@@ -0,0 +1,52 @@
+#pragma once
+#include "shell.h"
+
+// Constants
+// Expanded patterns, replacements and defaults are built on the stack
+#define PARAMETER_WORD_MAX_SIZE 4096
+// ${#NAME}
+#define PARAMETER_LENGTH 1
+// ${NAME:-WORD} and ${NAME-WORD}
+#define PARAMETER_DEFAULT 2
+// ${NAME:=WORD} and ${NAME=WORD}
+#define PARAMETER_ASSIGN 3
+// ${NAME#PATTERN} and ${NAME##PATTERN}
+#define PARAMETER_TRIM_PREFIX 4
+// ${NAME%PATTERN} and ${NAME%%PATTERN}
+#define PARAMETER_TRIM_SUFFIX 5
+// ${NAME/PATTERN/REPLACEMENT}, with // for every match and /# or /% to
+// anchor the match to the start or end
+#define PARAMETER_REPLACE 6
+// ${NAME:OFFSET} and ${NAME:OFFSET:LENGTH}
+#define PARAMETER_SUBSTRING 7
+#define PARAMETER_ANCHOR_NONE 0
+#define PARAMETER_ANCHOR_START 1
+#define PARAMETER_ANCHOR_END 2
+
+// A ${...} string operator; the name and words point into the input
+struct parameter_operator {
+    int kind;
+    const char *name;
+    size_t name_length;
+    // :- and := also use the word when the value is empty; ## and %% trim
+    // the longest match; // replaces every match
+    char colon;
+    char longest;
+    char all;
+    int anchor;
+    // The default, pattern, or offset
+    const char *word;
+    size_t word_length;
+    // The replacement, or the substring length
+    const char *second;
+    size_t second_length;
+    char has_second;
+};
+
+// Function type signatures
+size_t parse_parameter_operator(const char *text, struct parameter_operator *op);
+size_t expand_parameter_word(const char *text, size_t length, char *buffer, size_t size, char pattern);
+int glob_match(const char *pattern, size_t pattern_length, const char *text, size_t text_length);
+size_t trim_parameter(const char *value, size_t length, const char *pattern, size_t pattern_length, int suffix, int longest, size_t *start);
+int find_parameter_pattern(const char *value, size_t length, size_t from, const char *pattern, size_t pattern_length, int anchor, size_t *start, size_t *end);
+int substring_bounds(size_t length, const char *offset, const char *count, size_t *start, size_t *end);
@@ -0,0 +1,307 @@
+#include "functions.h"
+#include "completion.h"
+
+struct hash_table *functions = NULL;
+struct hash_table *aliases = NULL;
+int function_depth = 0;
+char return_pending = FALSE;
+int return_status = 0;
+// Arguments of the function call in progress ($1, $2, ...)
+char **positional_params = NULL;
+int positional_count = 0;
+// Formatted values of $# and $@
+char *positional_buf = NULL;
+
+void init_functions() {
+    if (functions == NULL) {
+        functions = hash_table_create(HASH_TABLE_DEFAULT_BUCKETS);
+        aliases = hash_table_create(HASH_TABLE_DEFAULT_BUCKETS);
+    }
+}
+
+struct shell_function *find_function(const char *name) {
+    return (struct shell_function *) hash_table_get(functions, name);
+}
+
+void define_function(const char *name, struct script_node *body) {
+    // The table keeps its own copy since the script that defined the
+    // function is freed once it finishes running
+    struct shell_function *function = (struct shell_function *) malloc(sizeof(struct shell_function));
+    function->body = copy_script_node(body);
+    function->refcount = 1;
+    struct shell_function *old_function = (struct shell_function *) hash_table_put(functions, name, function);
+    if (old_function != NULL) {
+        release_function(old_function);
+    }
+    else {
+        command_index_dirty = TRUE;
+    }
+}
+
+void release_function(struct shell_function *function) {
+    if (--function->refcount == 0) {
+        free_script(function->body);
+        free(function);
+    }
+}
+
+void call_function(struct shell_function *function, char **args, int count) {
+    // Runs the pre-parsed body in this process, without forking
+    struct parse_context context;
+    save_parse_context(&context);
+    char **saved_params = positional_params;
+    int saved_count = positional_count;
+    int saved_loop_depth = loop_depth;
+    // Copy the arguments since they belong to the caller's command
+    positional_params = (char **) malloc((count + 1) * sizeof(char *));
+    int k;
+    for (k = 0; k < count; ++k) {
+        positional_params[k] = strdup(args[k]);
+    }
+    positional_params[count] = NULL;
+    positional_count = count;
+    // Loops of the caller can't be left from inside the function
+    loop_depth = 0;
+    ++function->refcount;
+    ++function_depth;
+    run_node(function->body);
+    if (return_pending) {
+        return_pending = FALSE;
+        last_exit_status = return_status;
+    }
+    --function_depth;
+    release_function(function);
+    loop_depth = saved_loop_depth;
+    free_words(positional_params, positional_count);
+    positional_params = saved_params;
+    positional_count = saved_count;
+    restore_parse_context(&context);
+    cmd_exit_status = last_exit_status;
+    cmd_error = last_exit_status ? CMD_ERROR : CMD_OKAY;
+}
+
+void return_from_function(const char *status_arg) {
+    if (function_depth == 0) {
+        fprintf(stderr, "[Error]: return: can only be used in a function.\n");
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    return_status = (status_arg != NULL) ? atoi(status_arg) : last_exit_status;
+    return_pending = TRUE;
+}
+
+const char *get_positional_param(const char *name, size_t name_length) {
+    // Handles $1 through $N, $#, $@ and $*; returns NULL if unset
+    if (name[0] >= '0' && name[0] <= '9') {
+        int index = 0;
+        size_t k;
+        for (k = 0; k < name_length; ++k) {
+            index = index * 10 + (name[k] - '0');
+        }
+        if (index == 0) {
+            return "ship";
+        }
+        return (index <= positional_count) ? positional_params[index - 1] : NULL;
+    }
+    free(positional_buf);
+    if (name[0] == '#') {
+        positional_buf = (char *) malloc(VAR_SPECIAL_BUF_SIZE * sizeof(char));
+        snprintf(positional_buf, VAR_SPECIAL_BUF_SIZE, "%d", positional_count);
+        return positional_buf;
+    }
+    // $@ and $* join the parameters with spaces
+    size_t size = 1;
+    int k;
+    for (k = 0; k < positional_count; ++k) {
+        size += strlen(positional_params[k]) + 1;
+    }
+    positional_buf = (char *) malloc(size * sizeof(char));
+    positional_buf[0] = '\0';
+    for (k = 0; k < positional_count; ++k) {
+        if (k > 0) {
+            strcat(positional_buf, " ");
+        }
+        strcat(positional_buf, positional_params[k]);
+    }
+    return positional_buf;
+}
+
+char **copy_positional_params(int *count) {
+    char **params = (char **) malloc((positional_count + 1) * sizeof(char *));
+    int k;
+    for (k = 0; k < positional_count; ++k) {
+        params[k] = strdup(positional_params[k]);
+    }
+    params[positional_count] = NULL;
+    *count = positional_count;
+    return params;
+}
+
+void set_positional_params(char **args, int count) {
+    // Sets $1 through $N for a script, outside of any function
+    free_words(positional_params, positional_count);
+    positional_params = (char **) malloc((count + 1) * sizeof(char *));
+    int k;
+    for (k = 0; k < count; ++k) {
+        positional_params[k] = strdup(args[k]);
+    }
+    positional_params[count] = NULL;
+    positional_count = count;
+}
+
+static size_t expand_alias_at(char **text, size_t start) {
+    // Replaces the alias at start in *text, repeatedly while the expansion
+    // starts with another alias
+    // Returns where the expansion ends, or start if there was no alias
+    size_t rest_length = 0;
+    const char *seen[ALIAS_MAX_DEPTH];
+    int depth = 0;
+    while (depth < ALIAS_MAX_DEPTH) {
+        const char *current = &(*text)[start];
+        size_t word_length = strcspn(current, " \t;|<>&");
+        if (word_length == 0) {
+            break;
+        }
+        const char *value = (const char *) hash_table_get_n(aliases, current, word_length);
+        // An alias that expands to itself (alias ls='ls -a') stops expansion
+        int k;
+        for (k = 0; k < depth && value != NULL; ++k) {
+            if (seen[k] == value) {
+                value = NULL;
+            }
+        }
+        if (value == NULL) {
+            break;
+        }
+        if (depth == 0) {
+            rest_length = strlen(&current[word_length]);
+        }
+        seen[depth++] = value;
+        size_t value_length = strlen(value);
+        size_t length = start + value_length + strlen(&current[word_length]);
+        char *expanded = (char *) malloc((length + 1) * sizeof(char));
+        memcpy(expanded, *text, start);
+        memcpy(&expanded[start], value, value_length);
+        strcpy(&expanded[start + value_length], &current[word_length]);
+        free(*text);
+        *text = expanded;
+    }
+    return (depth == 0) ? start : strlen(*text) - rest_length;
+}
+
+static size_t next_command_position(const char *text, size_t index) {
+    // Returns the start of the command after the next unquoted | or ;, or
+    // the end of text if there is none
+    char quote = '\0';
+    int depth = 0;
+    while (text[index] != '\0') {
+        char c = text[index++];
+        if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            }
+            else if (c == '\\' && quote == '"' && text[index] != '\0') {
+                ++index;
+            }
+        }
+        else if (c == '\\' && text[index] != '\0') {
+            ++index;
+        }
+        else if (c == '\'' || c == '"' || c == '`') {
+            quote = c;
+        }
+        else if (c == '(') {
+            ++depth;
+        }
+        else if (c == ')' && depth > 0) {
+            --depth;
+        }
+        else if (depth == 0 && (c == ';' || c == '|')) {
+            if (c == '|' && text[index] == '{') {
+                // The capacity of a pipe (a |{1M} b)
+                const char *end = strchr(&text[index], '}');
+                index = (end != NULL) ? (size_t) (end - text) + 1 : strlen(text);
+            }
+            return index + strspn(&text[index], " \t\n");
+        }
+    }
+    return index;
+}
+
+char *expand_alias(const char *text) {
+    // Returns a new string with the aliases in command position (the start,
+    // and after | and ;) replaced, or NULL if there are none
+    // Commands inside an alias's value are not expanded again, so an alias
+    // can't expand into itself forever
+    char *result = strdup(text);
+    int expanded = FALSE;
+    size_t index = strspn(result, " \t\n");
+    while (result[index] != '\0') {
+        size_t end = expand_alias_at(&result, index);
+        expanded |= (end != index);
+        index = next_command_position(result, end);
+    }
+    if (!expanded) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+static void print_alias(const char *name, void *value, void *data) {
+    printf("alias %s='%s'\n", name, (const char *) value);
+}
+
+void alias_builtin(char **args) {
+    if (args[0] == NULL) {
+        hash_table_foreach(aliases, print_alias, NULL);
+        return;
+    }
+    int k;
+    for (k = 0; args[k] != NULL; ++k) {
+        char *equals = strchr(args[k], '=');
+        if (equals == NULL) {
+            const char *value = (const char *) hash_table_get(aliases, args[k]);
+            if (value == NULL) {
+                fprintf(stderr, "[Error]: alias: %s not found\n", args[k]);
+                cmd_error = CMD_ERROR;
+            }
+            else {
+                print_alias(args[k], (void *) value, NULL);
+            }
+            continue;
+        }
+        *equals = '\0';
+        if (equals == args[k] || strcspn(args[k], " \t;|<>&/=$`'\"") != strlen(args[k])) {
+            fprintf(stderr, "[Error]: alias: invalid name %s\n", args[k]);
+            cmd_error = CMD_ERROR;
+            *equals = '=';
+            continue;
+        }
+        char *old_value = (char *) hash_table_put(aliases, args[k], strdup(equals + 1));
+        if (old_value == NULL) {
+            command_index_dirty = TRUE;
+        }
+        free(old_value);
+        *equals = '=';
+    }
+}
+
+void unalias_builtin(char **args) {
+    if (args[0] != NULL && strcmp(args[0], "-a") == 0) {
+        hash_table_free(aliases, free);
+        aliases = hash_table_create(HASH_TABLE_DEFAULT_BUCKETS);
+        command_index_dirty = TRUE;
+        return;
+    }
+    int k;
+    for (k = 0; args[k] != NULL; ++k) {
+        char *value = (char *) hash_table_remove(aliases, args[k]);
+        if (value == NULL) {
+            fprintf(stderr, "[Error]: unalias: %s not found\n", args[k]);
+            cmd_error = CMD_ERROR;
+        }
+        free(value);
+        command_index_dirty = TRUE;
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "shell.h"
+#include "hash_table.h"
+#include "script.h"
+#include "variables.h"
+
+// Constants
+#define ALIAS_MAX_DEPTH 16
+
+// A function body is shared between the table and any calls in progress,
+// so redefining a running function doesn't free it from under the call
+struct shell_function {
+    struct script_node *body;
+    int refcount;
+};
+
+// Function type signatures
+void init_functions();
+struct shell_function *find_function(const char *name);
+void define_function(const char *name, struct script_node *body);
+void release_function(struct shell_function *function);
+void call_function(struct shell_function *function, char **args, int count);
+void return_from_function(const char *status_arg);
+char *expand_alias(const char *text);
+void alias_builtin(char **args);
+void unalias_builtin(char **args);
+const char *get_positional_param(const char *name, size_t name_length);
+char **copy_positional_params(int *count);
+void set_positional_params(char **args, int count);
+
+// Variables
+extern struct hash_table *functions;
+extern struct hash_table *aliases;
+extern int function_depth;
+extern char return_pending;
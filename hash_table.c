@@ -0,0 +1,138 @@
+#include "hash_table.h"
+#include "stats.h"
+
+unsigned long hash_string(const char *s, size_t length) {
+    return hash_bytes(HASH_OFFSET_BASIS, s, length);
+}
+
+unsigned long hash_bytes(unsigned long hash, const void *data, size_t length) {
+    // FNV-1a, continuing from hash so data can be hashed in pieces
+    const unsigned char *bytes = (const unsigned char *) data;
+    size_t i;
+    for (i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+struct hash_table *hash_table_create(size_t bucket_count) {
+    struct hash_table *table = (struct hash_table *) malloc(sizeof(struct hash_table));
+    table->buckets = (struct hash_entry **) calloc(bucket_count, sizeof(struct hash_entry *));
+    table->bucket_count = bucket_count;
+    table->count = 0;
+    return table;
+}
+
+static struct hash_entry *find_entry(struct hash_table *table, const char *key, size_t key_length) {
+    struct hash_entry *entry = table->buckets[hash_string(key, key_length) % table->bucket_count];
+    while (entry != NULL) {
+        if (strncmp(entry->key, key, key_length) == 0 && entry->key[key_length] == '\0') {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static void grow_table(struct hash_table *table) {
+    size_t new_bucket_count = table->bucket_count * 2;
+    struct hash_entry **new_buckets = (struct hash_entry **) calloc(new_bucket_count, sizeof(struct hash_entry *));
+    size_t i;
+    for (i = 0; i < table->bucket_count; ++i) {
+        struct hash_entry *entry = table->buckets[i];
+        while (entry != NULL) {
+            struct hash_entry *next = entry->next;
+            size_t bucket = hash_string(entry->key, strlen(entry->key)) % new_bucket_count;
+            entry->next = new_buckets[bucket];
+            new_buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = new_buckets;
+    table->bucket_count = new_bucket_count;
+}
+
+void *hash_table_get(struct hash_table *table, const char *key) {
+    return hash_table_get_n(table, key, strlen(key));
+}
+
+void *hash_table_get_n(struct hash_table *table, const char *key, size_t key_length) {
+    struct hash_entry *entry = find_entry(table, key, key_length);
+    COUNT_STAT(STAT_HASH_LOOKUPS, 1);
+    if (entry != NULL) {
+        COUNT_STAT(STAT_HASH_HITS, 1);
+        return entry->value;
+    }
+    return NULL;
+}
+
+void *hash_table_put(struct hash_table *table, const char *key, void *value) {
+    // Returns the value that was replaced, if any
+    size_t key_length = strlen(key);
+    struct hash_entry *entry = find_entry(table, key, key_length);
+    if (entry != NULL) {
+        void *old_value = entry->value;
+        entry->value = value;
+        return old_value;
+    }
+    if (table->count >= table->bucket_count * HASH_TABLE_MAX_LOAD) {
+        grow_table(table);
+    }
+    size_t bucket = hash_string(key, key_length) % table->bucket_count;
+    entry = (struct hash_entry *) malloc(sizeof(struct hash_entry));
+    entry->key = strdup(key);
+    entry->value = value;
+    entry->next = table->buckets[bucket];
+    table->buckets[bucket] = entry;
+    ++table->count;
+    return NULL;
+}
+
+void *hash_table_remove(struct hash_table *table, const char *key) {
+    // Returns the value that was removed, if any
+    struct hash_entry **link = &table->buckets[hash_string(key, strlen(key)) % table->bucket_count];
+    while (*link != NULL) {
+        if (strcmp((*link)->key, key) == 0) {
+            struct hash_entry *entry = *link;
+            void *value = entry->value;
+            *link = entry->next;
+            free(entry->key);
+            free(entry);
+            --table->count;
+            return value;
+        }
+        link = &(*link)->next;
+    }
+    return NULL;
+}
+
+void hash_table_foreach(struct hash_table *table, void (*callback)(const char *key, void *value, void *data), void *data) {
+    size_t i;
+    for (i = 0; i < table->bucket_count; ++i) {
+        struct hash_entry *entry = table->buckets[i];
+        while (entry != NULL) {
+            callback(entry->key, entry->value, data);
+            entry = entry->next;
+        }
+    }
+}
+
+void hash_table_free(struct hash_table *table, void (*free_value)(void *)) {
+    size_t i;
+    for (i = 0; i < table->bucket_count; ++i) {
+        struct hash_entry *entry = table->buckets[i];
+        while (entry != NULL) {
+            struct hash_entry *next = entry->next;
+            if (free_value != NULL) {
+                free_value(entry->value);
+            }
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    free(table);
+}
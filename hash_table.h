@@ -0,0 +1,32 @@
+#pragma once
+#include "shell.h"
+
+// Constants
+#define HASH_TABLE_DEFAULT_BUCKETS 64
+// Grow the table once the average chain length exceeds this
+#define HASH_TABLE_MAX_LOAD 2
+// Starting value for hash_bytes()
+#define HASH_OFFSET_BASIS 14695981039346656037UL
+
+struct hash_entry {
+    char *key;
+    void *value;
+    struct hash_entry *next;
+};
+
+struct hash_table {
+    struct hash_entry **buckets;
+    size_t bucket_count;
+    size_t count;
+};
+
+// Function type signatures
+unsigned long hash_string(const char *s, size_t length);
+unsigned long hash_bytes(unsigned long hash, const void *data, size_t length);
+struct hash_table *hash_table_create(size_t bucket_count);
+void *hash_table_get(struct hash_table *table, const char *key);
+void *hash_table_get_n(struct hash_table *table, const char *key, size_t key_length);
+void *hash_table_put(struct hash_table *table, const char *key, void *value);
+void *hash_table_remove(struct hash_table *table, const char *key);
+void hash_table_foreach(struct hash_table *table, void (*callback)(const char *key, void *value, void *data), void *data);
+void hash_table_free(struct hash_table *table, void (*free_value)(void *));
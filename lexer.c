@@ -0,0 +1,103 @@
+#include "lexer.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#define SPECIAL_AND_BREAK (LEX_SPECIAL | LEX_WORD_BREAK)
+
+unsigned char lex_char_class[256] = {
+    [0 ... LEX_SPECIAL_BELOW - 1] = LEX_SPECIAL,
+    [0] = SPECIAL_AND_BREAK,
+    ['\t'] = SPECIAL_AND_BREAK,
+    ['\n'] = SPECIAL_AND_BREAK,
+    [' '] = SPECIAL_AND_BREAK,
+    ['"'] = SPECIAL_AND_BREAK,
+    ['$'] = SPECIAL_AND_BREAK,
+    ['&'] = SPECIAL_AND_BREAK,
+    ['\''] = SPECIAL_AND_BREAK,
+    ['('] = SPECIAL_AND_BREAK,
+    [')'] = SPECIAL_AND_BREAK,
+    [';'] = SPECIAL_AND_BREAK,
+    ['<'] = SPECIAL_AND_BREAK,
+    ['>'] = SPECIAL_AND_BREAK,
+    ['\\'] = SPECIAL_AND_BREAK,
+    ['`'] = SPECIAL_AND_BREAK,
+    ['{'] = SPECIAL_AND_BREAK,
+    ['|'] = SPECIAL_AND_BREAK,
+    ['}'] = SPECIAL_AND_BREAK,
+    ['~'] = SPECIAL_AND_BREAK,
+};
+// Set by init_lexer() to the fastest scanner the CPU supports
+size_t (*lex_scan_plain)(const char *s) = lex_scan_plain_scalar;
+
+size_t lex_scan_plain_scalar(const char *s) {
+    // Returns the number of plain bytes at the start of s
+    const unsigned char *p = (const unsigned char *) s;
+    while (!(lex_char_class[*p] & LEX_SPECIAL)) {
+        ++p;
+    }
+    return p - (const unsigned char *) s;
+}
+
+#ifdef __SSE2__
+static inline unsigned special_mask_sse2(__m128i chunk) {
+    // One bit per special byte: below LEX_SPECIAL_BELOW (unsigned), one of
+    // ; < > \ ` or in { | } ~
+    __m128i below = _mm_cmpeq_epi8(_mm_min_epu8(chunk, _mm_set1_epi8(LEX_SPECIAL_BELOW - 1)), chunk);
+    __m128i braces = _mm_sub_epi8(chunk, _mm_set1_epi8('{'));
+    __m128i in_braces = _mm_cmpeq_epi8(_mm_min_epu8(braces, _mm_set1_epi8('~' - '{')), braces);
+    __m128i matches = _mm_or_si128(below, in_braces);
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(';')));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('<')));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('>')));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('`')));
+    return _mm_movemask_epi8(matches);
+}
+
+// Aligned loads never cross into the next page, so reading past the
+// terminator is safe, but not within what ASan considers the string
+__attribute__((no_sanitize_address))
+static size_t lex_scan_plain_sse2(const char *s) {
+    const char *chunk = (const char *) ((uintptr_t) s & ~(uintptr_t) 15);
+    // Ignore the bytes before s in the first chunk
+    unsigned mask = special_mask_sse2(_mm_load_si128((const __m128i *) chunk)) & (~0u << (s - chunk));
+    while (mask == 0) {
+        chunk += 16;
+        mask = special_mask_sse2(_mm_load_si128((const __m128i *) chunk));
+    }
+    return chunk + __builtin_ctz(mask) - s;
+}
+
+__attribute__((target("avx2")))
+static inline unsigned special_mask_avx2(__m256i chunk) {
+    __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, _mm256_set1_epi8(LEX_SPECIAL_BELOW - 1)), chunk);
+    __m256i braces = _mm256_sub_epi8(chunk, _mm256_set1_epi8('{'));
+    __m256i in_braces = _mm256_cmpeq_epi8(_mm256_min_epu8(braces, _mm256_set1_epi8('~' - '{')), braces);
+    __m256i matches = _mm256_or_si256(below, in_braces);
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(';')));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('<')));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('>')));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\')));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('`')));
+    return _mm256_movemask_epi8(matches);
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t lex_scan_plain_avx2(const char *s) {
+    const char *chunk = (const char *) ((uintptr_t) s & ~(uintptr_t) 31);
+    // A shift by 32 would be undefined, but s - chunk is at most 31
+    unsigned mask = special_mask_avx2(_mm256_load_si256((const __m256i *) chunk)) & (~0u << (s - chunk));
+    while (mask == 0) {
+        chunk += 32;
+        mask = special_mask_avx2(_mm256_load_si256((const __m256i *) chunk));
+    }
+    return chunk + __builtin_ctz(mask) - s;
+}
+#endif
+
+void init_lexer() {
+#ifdef __SSE2__
+    lex_scan_plain = __builtin_cpu_supports("avx2") ? lex_scan_plain_avx2 : lex_scan_plain_sse2;
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "shell.h"
+#include <stdint.h>
+
+// Character classes
+// LEX_SPECIAL marks every byte that the parsers may have to act on: NUL and
+// other control characters, the space, ! " # $ % & ' ( ), and ; < > \ ` { | } ~
+// The rest are copied into words as they are, so runs of them are skipped
+// in one step. A few plain bytes (!, #, %) are in the set too, since a
+// range is cheaper to test; they only end a run early
+#define LEX_SPECIAL 1
+// Bytes that end a word that script.c can split without parse_input()
+#define LEX_WORD_BREAK 2
+// Every byte below this one is special
+#define LEX_SPECIAL_BELOW '*'
+
+// Function type signatures
+void init_lexer();
+size_t lex_scan_plain_scalar(const char *s);
+
+// Variables
+extern unsigned char lex_char_class[256];
+extern size_t (*lex_scan_plain)(const char *s);
+
+// Inline helpers
+static inline int lex_is_special(char c) {
+    return lex_char_class[(unsigned char) c] & LEX_SPECIAL;
+}
+
+static inline int lex_is_word_break(char c) {
+    return lex_char_class[(unsigned char) c] & LEX_WORD_BREAK;
+}
@@ -0,0 +1,493 @@
+#include "memo.h"
+#include "hash_table.h"
+#include "options.h"
+#include "process.h"
+#include "parallel.h"
+#include "variables.h"
+#include "trace.h"
+#include "rcfile.h"
+#include "stats.h"
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+static int make_directories(char *path) {
+    // mkdir -p, with the directories only readable by the user
+    char *slash;
+    for (slash = strchr(path + 1, '/'); ; slash = strchr(slash + 1, '/')) {
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        int result = mkdir(path, 0700);
+        if (slash != NULL) {
+            *slash = '/';
+        }
+        if (result < 0 && errno != EEXIST) {
+            return -1;
+        }
+        if (slash == NULL) {
+            return 0;
+        }
+    }
+}
+
+static void precise_file_times(struct timespec times[2]) {
+    // File times come from a coarse clock, so entries used within a few
+    // milliseconds of each other would tie; set them from a precise one
+    clock_gettime(CLOCK_REALTIME, &times[0]);
+    times[1] = times[0];
+}
+
+int memo_dir(char *path, size_t size) {
+    // Finds the cache directory, creating it if needed
+    // Returns -1 with errno set if there is none
+    const char *dir = getenv(MEMO_DIR_ENV_VAR);
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    size_t length;
+    if (dir != NULL && *dir != '\0') {
+        length = snprintf(path, size, "%s", dir);
+    }
+    else if (cache_home != NULL && *cache_home != '\0') {
+        length = snprintf(path, size, "%s/%s", cache_home, MEMO_DIR_NAME);
+    }
+    else if (home != NULL) {
+        length = snprintf(path, size, "%s/.cache/%s", home, MEMO_DIR_NAME);
+    }
+    else {
+        errno = ENOENT;
+        return -1;
+    }
+    if (length >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return make_directories(path);
+}
+
+void add_to_memo_key(struct memo_key *key, const char *data, size_t length) {
+    // Appends data and a separator, so ("ab", "c") and ("a", "bc") differ
+    if (key->length + length + 1 > key->capacity) {
+        key->capacity = (key->length + length + 1) * 2;
+        key->data = (char *) realloc(key->data, key->capacity * sizeof(char));
+    }
+    memcpy(&key->data[key->length], data, length);
+    key->length += length;
+    key->data[key->length++] = '\0';
+}
+
+int add_file_to_memo_key(struct memo_key *key, const char *path, char by_content) {
+    // Adds the hash of a file's contents, or its size and mtime
+    // A missing file is part of the key too, so creating it is a change
+    // Returns -1 with errno set if the file exists but can't be read
+    char description[128];
+    struct stat file_stat;
+    add_to_memo_key(key, path, strlen(path));
+    if (stat(path, &file_stat) < 0) {
+        if (errno != ENOENT) {
+            return -1;
+        }
+        add_to_memo_key(key, "missing", strlen("missing"));
+        return 0;
+    }
+    if (!by_content) {
+        snprintf(description, sizeof(description), "size %lld mtime %lld.%09ld", (long long) file_stat.st_size,
+                 (long long) file_stat.st_mtim.tv_sec, file_stat.st_mtim.tv_nsec);
+        add_to_memo_key(key, description, strlen(description));
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    char *buffer = (char *) malloc(MEMO_READ_SIZE * sizeof(char));
+    unsigned long hash = HASH_OFFSET_BASIS;
+    unsigned long long length = 0;
+    ssize_t bytes;
+    while ((bytes = read(fd, buffer, MEMO_READ_SIZE)) != 0) {
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            int error = errno;
+            free(buffer);
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        hash = hash_bytes(hash, buffer, bytes);
+        length += bytes;
+    }
+    free(buffer);
+    close(fd);
+    snprintf(description, sizeof(description), "content %016lx length %llu", hash, length);
+    add_to_memo_key(key, description, strlen(description));
+    return 0;
+}
+
+int load_memo_entry(const char *path, const struct memo_key *key, int *exit_status, char **output, size_t *output_length) {
+    // Returns TRUE on a hit, with the output in a new buffer
+    size_t length;
+    char *data = read_file(path, &length);
+    if (data == NULL) {
+        return FALSE;
+    }
+    struct memo_entry_header header;
+    int hit = length >= sizeof(header);
+    if (hit) {
+        memcpy(&header, data, sizeof(header));
+        hit = memcmp(header.magic, MEMO_MAGIC, sizeof(header.magic)) == 0
+              && header.version == MEMO_VERSION
+              && header.key_length == key->length
+              && sizeof(header) + header.key_length + header.output_length == length
+              && memcmp(&data[sizeof(header)], key->data, key->length) == 0;
+    }
+    if (!hit) {
+        free(data);
+        return FALSE;
+    }
+    // Reuse the buffer for the output
+    *exit_status = header.exit_status;
+    *output_length = header.output_length;
+    memmove(data, &data[sizeof(header) + header.key_length], header.output_length);
+    *output = data;
+    return TRUE;
+}
+
+int save_memo_entry(const char *dir, const char *name, const struct memo_key *key, int exit_status, const char *output, size_t output_length) {
+    // Writes the entry to a temporary file and renames it into place, so
+    // readers never see half an entry
+    // Returns -1 with errno set on failure
+    char temp_path[MEMO_PATH_MAX_SIZE];
+    char path[MEMO_PATH_MAX_SIZE];
+    snprintf(temp_path, sizeof(temp_path), "%s/%s.%d.tmp", dir, name, getpid());
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    struct memo_entry_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MEMO_MAGIC, sizeof(header.magic));
+    header.version = MEMO_VERSION;
+    header.exit_status = exit_status;
+    header.key_length = key->length;
+    header.output_length = output_length;
+    struct iovec parts[3] = {
+        {&header, sizeof(header)},
+        {key->data, key->length},
+        {(void *) output, output_length},
+    };
+    ssize_t expected = sizeof(header) + key->length + output_length;
+    ssize_t written = writev(fd, parts, 3);
+    // A short write means the disk is full
+    int error = (written < 0) ? errno : ENOSPC;
+    struct timespec times[2];
+    precise_file_times(times);
+    futimens(fd, times);
+    close(fd);
+    if (written == expected && rename(temp_path, path) == 0) {
+        return 0;
+    }
+    if (written == expected) {
+        error = errno;
+    }
+    unlink(temp_path);
+    errno = error;
+    return -1;
+}
+
+int run_and_capture(char **argv, int count, char **output, size_t *output_length) {
+    // Runs argv through execute() in a subshell, passing its stdout on as
+    // it arrives and keeping a copy
+    // Returns the wait status, or -1 on error
+    int pipes[2];
+    COUNT_STAT(STAT_PIPES, 1);
+    if (pipe2(pipes, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    fflush(stdout);
+    COUNT_STAT(STAT_FORKS, 1);
+    int pid = fork();
+    if (pid < 0) {
+        close(pipes[0]);
+        close(pipes[1]);
+        return -1;
+    }
+    if (!pid) {
+        close(pipes[0]);
+        if (dup2(pipes[1], STDOUT_FILENO) < 0) {
+            print_error();
+            exit(1);
+        }
+        close(pipes[1]);
+        // The earlier stages of the pipeline aren't this child's to wait for
+        pipeline_child_count = 0;
+        in_pipeline = FALSE;
+        opts = argv;
+        optCount = count;
+        execute();
+        fflush(stdout);
+        exit(CMD_FAILED(cmd_error) ? (cmd_exit_status ? cmd_exit_status : 1) : 0);
+    }
+    if (TRACING) {
+        trace_process_start(pid, argv);
+    }
+    close(pipes[1]);
+    size_t capacity = MEMO_READ_SIZE;
+    *output = (char *) malloc(capacity * sizeof(char));
+    *output_length = 0;
+    while (TRUE) {
+        if (*output_length == capacity) {
+            capacity *= 2;
+            *output = (char *) realloc(*output, capacity * sizeof(char));
+        }
+        ssize_t bytes = read(pipes[0], &(*output)[*output_length], capacity - *output_length);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        write_all(STDOUT_FILENO, &(*output)[*output_length], bytes);
+        *output_length += bytes;
+    }
+    close(pipes[0]);
+    int status;
+    if (wait_for_children(&pid, &status, 1) < 0) {
+        return -1;
+    }
+    return status;
+}
+
+static int compare_memo_files(const void *a, const void *b) {
+    // Oldest first
+    const struct timespec *x = &((const struct memo_file *) a)->mtime;
+    const struct timespec *y = &((const struct memo_file *) b)->mtime;
+    if (x->tv_sec != y->tv_sec) {
+        return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+static int is_memo_entry_name(const char *name) {
+    return strlen(name) == MEMO_NAME_LENGTH && strspn(name, "0123456789abcdef") == MEMO_NAME_LENGTH;
+}
+
+void evict_memo_entries(const char *dir, long limit) {
+    // Removes the least recently used entries (hits update the mtime) until
+    // the entries take up at most limit bytes
+    DIR *entries = opendir(dir);
+    if (entries == NULL) {
+        return;
+    }
+    size_t count = 0;
+    size_t capacity = 64;
+    struct memo_file *files = (struct memo_file *) malloc(capacity * sizeof(struct memo_file));
+    long long total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(entries)) != NULL) {
+        struct stat file_stat;
+        if (!is_memo_entry_name(entry->d_name) || fstatat(dirfd(entries), entry->d_name, &file_stat, 0) < 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            files = (struct memo_file *) realloc(files, capacity * sizeof(struct memo_file));
+        }
+        // is_memo_entry_name() checked the length
+        memcpy(files[count].name, entry->d_name, MEMO_NAME_LENGTH + 1);
+        files[count].mtime = file_stat.st_mtim;
+        files[count].size = file_stat.st_size;
+        total += file_stat.st_size;
+        ++count;
+    }
+    if (total > limit) {
+        qsort(files, count, sizeof(struct memo_file), compare_memo_files);
+        size_t k;
+        for (k = 0; k < count && total > limit; ++k) {
+            if (unlinkat(dirfd(entries), files[k].name, 0) == 0) {
+                total -= files[k].size;
+            }
+        }
+    }
+    closedir(entries);
+    free(files);
+}
+
+void update_memo_stats(const char *dir, int hits, int misses, unsigned long long *total_hits, unsigned long long *total_misses) {
+    // Adds to the counters in the stats file, which is shared by every shell
+    // (and every command substitution), so it's updated under a lock
+    char path[MEMO_PATH_MAX_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, MEMO_STATS_FILE_NAME);
+    *total_hits = 0;
+    *total_misses = 0;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    char buffer[64];
+    ssize_t bytes = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    buffer[bytes > 0 ? bytes : 0] = '\0';
+    sscanf(buffer, "%llu %llu", total_hits, total_misses);
+    if (hits || misses) {
+        *total_hits += hits;
+        *total_misses += misses;
+        int length = snprintf(buffer, sizeof(buffer), "%llu %llu\n", *total_hits, *total_misses);
+        if (pwrite(fd, buffer, length, 0) == length) {
+            ftruncate(fd, length);
+        }
+    }
+    close(fd);
+}
+
+void print_memo_stats(const char *dir) {
+    unsigned long long hits;
+    unsigned long long misses;
+    update_memo_stats(dir, 0, 0, &hits, &misses);
+    long long bytes = 0;
+    long entry_count = 0;
+    DIR *entries = opendir(dir);
+    struct dirent *entry;
+    while (entries != NULL && (entry = readdir(entries)) != NULL) {
+        struct stat file_stat;
+        if (is_memo_entry_name(entry->d_name) && fstatat(dirfd(entries), entry->d_name, &file_stat, 0) == 0) {
+            bytes += file_stat.st_size;
+            ++entry_count;
+        }
+    }
+    if (entries != NULL) {
+        closedir(entries);
+    }
+    printf("%-10s %s\n", "directory", dir);
+    printf("%-10s %llu\n", "hits", hits);
+    printf("%-10s %llu\n", "misses", misses);
+    printf("%-10s %.1f%%\n", "hit rate", (hits + misses) ? 100.0 * hits / (hits + misses) : 0.0);
+    printf("%-10s %ld\n", "entries", entry_count);
+    printf("%-10s %lld (limit %ld)\n", "bytes", bytes, get_option(OPT_MEMO_SIZE));
+}
+
+void clear_memo_entries(const char *dir) {
+    // Removes every entry and resets the counters
+    evict_memo_entries(dir, 0);
+    char path[MEMO_PATH_MAX_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, MEMO_STATS_FILE_NAME);
+    unlink(path);
+}
+
+void memo_builtin(char **args, int count) {
+    // memo [-i FILE]... [-t FILE]... [-e NAME]... command [args...]
+    // memo --stats | --clear
+    // Replays the stdout and exit status of an earlier run of the same
+    // command, or runs it and caches them
+    char dir[MEMO_DIR_MAX_SIZE];
+    if (memo_dir(dir, sizeof(dir)) < 0) {
+        fprintf(stderr, "[Error]: memo: no cache directory: %s\n", strerror(errno));
+        cmd_exit_status = 1;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (count == 1 && strcmp(args[0], "--stats") == 0) {
+        print_memo_stats(dir);
+        return;
+    }
+    if (count == 1 && strcmp(args[0], "--clear") == 0) {
+        clear_memo_entries(dir);
+        return;
+    }
+    struct memo_key key = {NULL, 0, 0};
+    const char *error = NULL;
+    int k = 0;
+    // The options go into the key in order, then the command and the cwd
+    while (error == NULL && k < count && args[k][0] == '-') {
+        const char *value = (k + 1 < count) ? args[k + 1] : NULL;
+        if (value == NULL) {
+            error = "missing option value";
+        }
+        else if (strcmp(args[k], "-i") == 0 || strcmp(args[k], "-t") == 0) {
+            if (add_file_to_memo_key(&key, value, args[k][1] == 'i') < 0) {
+                fprintf(stderr, "[Error]: memo: %s: %s\n", value, strerror(errno));
+                error = "cannot read input file";
+            }
+        }
+        else if (strcmp(args[k], "-e") == 0) {
+            const char *var = get_var(value);
+            add_to_memo_key(&key, value, strlen(value));
+            add_to_memo_key(&key, var != NULL ? var : "", var != NULL ? strlen(var) : 0);
+            // Unset differs from empty
+            add_to_memo_key(&key, var != NULL ? "set" : "unset", var != NULL ? 3 : 5);
+        }
+        else {
+            error = "invalid option";
+        }
+        k += 2;
+    }
+    if (error == NULL && k >= count) {
+        error = "usage: memo [-i FILE]... [-t FILE]... [-e NAME]... command [args...]";
+    }
+    // A cached built-in would skip its effect on the shell
+    if (error == NULL && is_builtin(args[k])) {
+        error = "cannot memoize a built-in";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: memo: %s\n", error);
+        free(key.data);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    int j;
+    for (j = k; j < count; ++j) {
+        add_to_memo_key(&key, args[j], strlen(args[j]));
+    }
+    char cwd[MEMO_PATH_MAX_SIZE];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        add_to_memo_key(&key, cwd, strlen(cwd));
+    }
+    char name[MEMO_NAME_LENGTH + 1];
+    snprintf(name, sizeof(name), "%016lx", hash_string(key.data, key.length));
+    char path[MEMO_PATH_MAX_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    unsigned long long hits;
+    unsigned long long misses;
+    int exit_status;
+    char *output;
+    size_t output_length;
+    COUNT_STAT(STAT_MEMO_LOOKUPS, 1);
+    if (load_memo_entry(path, &key, &exit_status, &output, &output_length)) {
+        COUNT_STAT(STAT_MEMO_HITS, 1);
+        fflush(stdout);
+        write_all(STDOUT_FILENO, output, output_length);
+        free(output);
+        free(key.data);
+        // Recently used entries are evicted last
+        struct timespec times[2];
+        precise_file_times(times);
+        utimensat(AT_FDCWD, path, times, 0);
+        update_memo_stats(dir, 1, 0, &hits, &misses);
+        cmd_exit_status = exit_status;
+        cmd_error = exit_status ? CMD_ERROR : CMD_OKAY;
+        return;
+    }
+    int status = run_and_capture(&args[k], count - k, &output, &output_length);
+    if (status < 0) {
+        print_error();
+        free(key.data);
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    update_memo_stats(dir, 0, 1, &hits, &misses);
+    // Runs that were interrupted, killed, or never started aren't worth
+    // repeating
+    if (WIFEXITED(status) && !interrupted && WEXITSTATUS(status) != EXEC_NOT_FOUND_EXIT_CODE
+        && WEXITSTATUS(status) != EXEC_FAIL_EXIT_CODE) {
+        if (save_memo_entry(dir, name, &key, WEXITSTATUS(status), output, output_length) < 0) {
+            fprintf(stderr, "[Error]: memo: %s: %s\n", path, strerror(errno));
+        }
+        evict_memo_entries(dir, get_option(OPT_MEMO_SIZE));
+    }
+    free(output);
+    free(key.data);
+    record_wait_status(status);
+}
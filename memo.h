@@ -0,0 +1,55 @@
+#pragma once
+#include "shell.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Constants
+#define MEMO_DIR_ENV_VAR "SHIP_MEMO_DIR"
+// Under $XDG_CACHE_HOME, or ~/.cache without it
+#define MEMO_DIR_NAME "ship/memo"
+#define MEMO_STATS_FILE_NAME "stats"
+#define MEMO_MAGIC "SHIPMEM\x01"
+#define MEMO_VERSION 1
+#define MEMO_PATH_MAX_SIZE 4096
+// Leaves room in a path for the name of a file in the directory
+#define MEMO_DIR_MAX_SIZE (MEMO_PATH_MAX_SIZE - 64)
+#define MEMO_READ_SIZE 65536
+// Entry file names are the key's hash in hex
+#define MEMO_NAME_LENGTH 16
+
+// Start of an entry file, followed by the key and then the output; the key
+// is compared on a hit, so a hash collision is just a miss
+struct memo_entry_header {
+    char magic[8];
+    uint32_t version;
+    int32_t exit_status;
+    uint64_t key_length;
+    uint64_t output_length;
+};
+
+// Everything a cached result depends on, in one buffer
+struct memo_key {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// An entry file, for eviction
+struct memo_file {
+    char name[MEMO_NAME_LENGTH + 1];
+    struct timespec mtime;
+    off_t size;
+};
+
+// Function type signatures
+void memo_builtin(char **args, int count);
+int memo_dir(char *path, size_t size);
+void add_to_memo_key(struct memo_key *key, const char *data, size_t length);
+int add_file_to_memo_key(struct memo_key *key, const char *path, char by_content);
+int load_memo_entry(const char *path, const struct memo_key *key, int *exit_status, char **output, size_t *output_length);
+int save_memo_entry(const char *dir, const char *name, const struct memo_key *key, int exit_status, const char *output, size_t output_length);
+int run_and_capture(char **argv, int count, char **output, size_t *output_length);
+void evict_memo_entries(const char *dir, long limit);
+void update_memo_stats(const char *dir, int hits, int misses, unsigned long long *total_hits, unsigned long long *total_misses);
+void print_memo_stats(const char *dir);
+void clear_memo_entries(const char *dir);
@@ -0,0 +1,300 @@
+#include "onchange.h"
+#include "trace.h"
+#include "stats.h"
+#include <dirent.h>
+
+static long long monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static struct onchange_watch *find_onchange_watch(struct onchange_watches *watches, int wd) {
+    int k;
+    for (k = 0; k < watches->count; ++k) {
+        if (watches->watches[k].wd == wd) {
+            return &watches->watches[k];
+        }
+    }
+    return NULL;
+}
+
+static char *join_path(const char *directory, const char *name) {
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char *path = (char *) malloc(length * sizeof(char));
+    snprintf(path, length, "%s/%s", directory, name);
+    return path;
+}
+
+int add_onchange_watch(struct onchange_watches *watches, const char *path, char top_level) {
+    // Watches path and, if recursive, the directories below it
+    // Returns the watch descriptor, or -1 with errno set
+    // Paths given by the user may be symlinks; ones found while recursing
+    // are only followed if they are real directories
+    int wd = inotify_add_watch(watches->fd, path, ONCHANGE_EVENTS | (top_level ? 0 : IN_ONLYDIR | IN_DONT_FOLLOW));
+    if (wd < 0) {
+        return -1;
+    }
+    struct onchange_watch *watch = find_onchange_watch(watches, wd);
+    if (watch != NULL) {
+        // Already watched through another path
+        watch->top_level |= top_level;
+        return wd;
+    }
+    if (watches->count == watches->capacity) {
+        watches->capacity = watches->capacity ? watches->capacity * 2 : 16;
+        watches->watches = (struct onchange_watch *) realloc(watches->watches, watches->capacity * sizeof(struct onchange_watch));
+    }
+    watch = &watches->watches[watches->count++];
+    watch->wd = wd;
+    watch->path = strdup(path);
+    watch->top_level = top_level;
+    if (watches->recursive) {
+        add_onchange_subdirectories(watches, path);
+    }
+    return wd;
+}
+
+void add_onchange_subdirectories(struct onchange_watches *watches, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        // Not a directory, or one that went away in the meantime
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0
+            || (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)) {
+            continue;
+        }
+        // IN_ONLYDIR rejects the unknown entries that aren't directories
+        char *child = join_path(path, entry->d_name);
+        if (add_onchange_watch(watches, child, FALSE) < 0 && errno == ENOSPC) {
+            fprintf(stderr, "[Error]: onchange: too many watches (see /proc/sys/fs/inotify/max_user_watches)\n");
+            watches->recursive = FALSE;
+        }
+        free(child);
+    }
+    closedir(dir);
+}
+
+int read_onchange_events(struct onchange_watches *watches) {
+    // Reads every pending event, watching new directories if recursive
+    // Returns the number of changes, or -1 on error
+    char buffer[ONCHANGE_READ_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changes = 0;
+    while (TRUE) {
+        ssize_t bytes = read(watches->fd, buffer, sizeof(buffer));
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN) ? changes : -1;
+        }
+        char *next = buffer;
+        while (next < buffer + bytes) {
+            const struct inotify_event *event = (const struct inotify_event *) next;
+            next += sizeof(struct inotify_event) + event->len;
+            struct onchange_watch *watch = find_onchange_watch(watches, event->wd);
+            if (event->mask & IN_IGNORED) {
+                // The watch is gone along with what it watched; paths given
+                // by the user are watched again before the next run
+                if (watch != NULL && watch->top_level) {
+                    watch->wd = NO_FD;
+                }
+                else if (watch != NULL) {
+                    free(watch->path);
+                    *watch = watches->watches[--watches->count];
+                }
+                continue;
+            }
+            if (watches->recursive && watch != NULL && event->len > 0
+                && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                char *child = join_path(watch->path, event->name);
+                add_onchange_watch(watches, child, FALSE);
+                free(child);
+            }
+            // IN_Q_OVERFLOW lost some events, which still means a change
+            ++changes;
+        }
+    }
+}
+
+int start_onchange_run(char **argv, int count) {
+    // Runs argv through execute() in a subshell
+    // Returns its pid, or -1 on error
+    fflush(stdout);
+    COUNT_STAT(STAT_FORKS, 1);
+    int pid = fork();
+    if (pid < 0) {
+        print_error();
+        return -1;
+    }
+    if (!pid) {
+        // A process group of its own, so stopping the run reaches everything
+        // it started
+        setpgid(0, 0);
+        // Reading the terminal from outside its foreground group would stop
+        // the run with SIGTTIN
+        if (isatty(STDIN_FILENO)) {
+            int dev_null = open("/dev/null", O_RDONLY);
+            dup2(dev_null, STDIN_FILENO);
+            close(dev_null);
+        }
+        // The earlier stages of the pipeline aren't this child's to wait for
+        pipeline_child_count = 0;
+        in_pipeline = FALSE;
+        opts = argv;
+        optCount = count;
+        execute();
+        fflush(stdout);
+        exit(CMD_FAILED(cmd_error) ? (cmd_exit_status ? cmd_exit_status : 1) : 0);
+    }
+    // Also in the parent, so the group exists before anything signals it
+    setpgid(pid, pid);
+    if (TRACING) {
+        trace_process_start(pid, argv);
+    }
+    return pid;
+}
+
+int stop_onchange_run(int pid, int sig) {
+    // Signals the run's process group and returns its wait status
+    kill(-pid, sig);
+    int status = W_EXITCODE(0, sig);
+    wait_for_children(&pid, &status, 1);
+    return status;
+}
+
+void onchange_builtin(char **args, int count) {
+    // onchange [-r] [-d MS] path... -- command [args...]
+    // Runs command, then runs it again whenever one of the paths changes,
+    // until SIGINT
+    struct onchange_watches watches = {NO_FD, NULL, 0, 0, FALSE};
+    long debounce = ONCHANGE_DEFAULT_DEBOUNCE_MS;
+    const char *error = NULL;
+    int k = 0;
+    while (error == NULL && k < count && args[k][0] == '-' && strcmp(args[k], ONCHANGE_SEPARATOR) != 0) {
+        if (strcmp(args[k], "-r") == 0) {
+            watches.recursive = TRUE;
+        }
+        else if (strcmp(args[k], "-d") == 0) {
+            char *end;
+            if (k + 1 >= count || (debounce = strtol(args[++k], &end, 10)) < 0 || *end != '\0') {
+                error = "-d needs a number of milliseconds";
+            }
+        }
+        else {
+            error = "invalid option";
+        }
+        ++k;
+    }
+    int separator = k;
+    while (separator < count && strcmp(args[separator], ONCHANGE_SEPARATOR) != 0) {
+        ++separator;
+    }
+    if (error == NULL && (separator == k || separator + 1 >= count)) {
+        error = "usage: onchange [-r] [-d MS] path... -- command [args...]";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: onchange: %s\n", error);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if ((watches.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        print_error();
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    int watched = TRUE;
+    int j;
+    for (j = k; j < separator && watched; ++j) {
+        if (add_onchange_watch(&watches, args[j], TRUE) < 0) {
+            fprintf(stderr, "[Error]: onchange: %s: %s\n", args[j], strerror(errno));
+            watched = FALSE;
+        }
+    }
+
+    char **command = &args[separator + 1];
+    int command_count = count - separator - 1;
+    int pid = watched ? start_onchange_run(command, command_count) : -1;
+    int pidfd = (pid > 0) ? open_pidfd(pid) : NO_FD;
+    int status = 0;
+    // When the last of a burst of changes is old enough to run again, or -1
+    long long deadline = -1;
+    while (pid >= 0 && !interrupted) {
+        // Sleeps in poll() until something changes, a run ends, or SIGINT
+        struct pollfd fds[3] = {{signal_fd, POLLIN, 0}, {watches.fd, POLLIN, 0}, {pidfd, POLLIN, 0}};
+        int timeout = -1;
+        if (deadline >= 0) {
+            long long now = monotonic_ms();
+            timeout = (deadline > now) ? deadline - now : 0;
+        }
+        if (poll(fds, 3, timeout) < 0 && errno != EINTR) {
+            print_error();
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            check_signals();
+        }
+        // Without a pidfd, SIGCHLD on signal_fd signals the exit instead
+        if (pid > 0 && (pidfd < 0 || (fds[2].revents & POLLIN)) && waitpid(pid, &status, WNOHANG) == pid) {
+            if (TRACING) {
+                trace_process_end(pid, status);
+            }
+            if (pidfd >= 0) {
+                close(pidfd);
+            }
+            pid = 0;
+            pidfd = NO_FD;
+        }
+        if (fds[1].revents & POLLIN) {
+            int changes = read_onchange_events(&watches);
+            if (changes < 0) {
+                print_error();
+                break;
+            }
+            if (changes > 0) {
+                // Every change in a burst pushes the run back
+                deadline = monotonic_ms() + debounce;
+            }
+        }
+        if (interrupted || deadline < 0 || monotonic_ms() < deadline) {
+            continue;
+        }
+        deadline = -1;
+        if (pid > 0) {
+            // The previous run is out of date
+            status = stop_onchange_run(pid, SIGTERM);
+            if (pidfd >= 0) {
+                close(pidfd);
+            }
+        }
+        for (j = 0; j < watches.count; ++j) {
+            if (watches.watches[j].wd < 0) {
+                // Replaced files have usually been recreated by now
+                watches.watches[j].wd = inotify_add_watch(watches.fd, watches.watches[j].path, ONCHANGE_EVENTS);
+            }
+        }
+        pid = start_onchange_run(command, command_count);
+        pidfd = (pid > 0) ? open_pidfd(pid) : NO_FD;
+    }
+    if (pid > 0) {
+        // SIGINT only reached the shell, since the run has its own group
+        status = stop_onchange_run(pid, SIGINT);
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    close(watches.fd);
+    for (j = 0; j < watches.count; ++j) {
+        free(watches.watches[j].path);
+    }
+    free(watches.watches);
+    if (pid < 0) {
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    record_wait_status(status);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "shell.h"
+#include "process.h"
+#include <sys/inotify.h>
+
+// Constants
+#define ONCHANGE_SEPARATOR "--"
+#define ONCHANGE_DEFAULT_DEBOUNCE_MS 100
+// Changes that are worth re-running the command for
+#define ONCHANGE_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE \
+                         | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#define ONCHANGE_READ_SIZE 4096
+
+// A watched path; the ones given on the command line are re-watched after
+// they are replaced (like editors do when saving)
+struct onchange_watch {
+    int wd;
+    char *path;
+    char top_level;
+};
+
+// Everything onchange watches
+struct onchange_watches {
+    int fd;
+    struct onchange_watch *watches;
+    int count;
+    int capacity;
+    char recursive;
+};
+
+// Function type signatures
+void onchange_builtin(char **args, int count);
+int add_onchange_watch(struct onchange_watches *watches, const char *path, char top_level);
+void add_onchange_subdirectories(struct onchange_watches *watches, const char *path);
+int read_onchange_events(struct onchange_watches *watches);
+int start_onchange_run(char **argv, int count);
+int stop_onchange_run(int pid, int sig);
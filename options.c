@@ -0,0 +1,88 @@
+#include "options.h"
+
+struct shell_option shell_options[OPTION_COUNT] = {
+    {"pipe_size", 0, "capacity of pipeline pipes in bytes (0 for the kernel default)"},
+    {"arg_batch", 0, "batches run at once when arguments exceed ARG_MAX (0 to fail instead)"},
+    {"memo_size", 64 << 20, "bytes the memo cache keeps before evicting the least recently used"},
+    {"completion_limit", 1000, "file names offered by tab completion (0 for no limit)"},
+    {"prompt_duration", 2000, "milliseconds a line must take for the prompt to show its duration"},
+};
+
+int find_option(const char *name) {
+    // Returns the index of the option, or -1 if there is none called name
+    int k;
+    for (k = 0; k < OPTION_COUNT; ++k) {
+        if (strcmp(shell_options[k].name, name) == 0) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+long get_option(int option) {
+    return shell_options[option].value;
+}
+
+int parse_size(const char *text, long *size) {
+    // Parses a non-negative number with an optional K, M, or G suffix
+    // Returns 0 on success, or -1 if text is not a size
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || value < 0 || errno) {
+        return -1;
+    }
+    int shift = 0;
+    switch (*end) {
+        case 'k':
+        case 'K':
+            shift = 10;
+            ++end;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            ++end;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            ++end;
+            break;
+    }
+    if (*end != '\0' || value > (LONG_MAX >> shift)) {
+        return -1;
+    }
+    *size = value << shift;
+    return 0;
+}
+
+void shopt_builtin(char **args) {
+    // shopt lists every option, shopt NAME prints one, shopt NAME VALUE sets one
+    if (args[0] == NULL) {
+        int k;
+        for (k = 0; k < OPTION_COUNT; ++k) {
+            printf("%-16s %-10ld # %s\n", shell_options[k].name, shell_options[k].value, shell_options[k].description);
+        }
+        return;
+    }
+    int option = find_option(args[0]);
+    if (option < 0) {
+        fprintf(stderr, "[Error]: shopt: %s: invalid option name\n", args[0]);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (args[1] == NULL) {
+        printf("%ld\n", shell_options[option].value);
+        return;
+    }
+    long value;
+    if (parse_size(args[1], &value) < 0) {
+        fprintf(stderr, "[Error]: shopt: %s: invalid value %s\n", args[0], args[1]);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    shell_options[option].value = value;
+}
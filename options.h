@@ -0,0 +1,27 @@
+#pragma once
+#include "shell.h"
+#include <limits.h>
+
+// Shell options, indices into shell_options
+#define OPT_PIPE_SIZE 0
+#define OPT_ARG_BATCH 1
+#define OPT_MEMO_SIZE 2
+#define OPT_COMPLETION_LIMIT 3
+#define OPT_PROMPT_DURATION 4
+#define OPTION_COUNT 5
+
+// An option set with the shopt built-in
+struct shell_option {
+    const char *name;
+    long value;
+    const char *description;
+};
+
+// Function type signatures
+int find_option(const char *name);
+long get_option(int option);
+int parse_size(const char *text, long *size);
+void shopt_builtin(char **args);
+
+// Variables
+extern struct shell_option shell_options[OPTION_COUNT];
@@ -0,0 +1,353 @@
+#include "parallel.h"
+#include "trace.h"
+#include "stats.h"
+
+static void add_parallel_item(struct parallel_input *input, const char *line, size_t length) {
+    // Empty lines are skipped
+    if (length == 0) {
+        return;
+    }
+    if (input->count == input->capacity) {
+        input->capacity = input->capacity ? input->capacity * 2 : 16;
+        input->items = (char **) realloc(input->items, input->capacity * sizeof(char *));
+    }
+    input->items[input->count++] = strndup(line, length);
+}
+
+void read_parallel_input(struct parallel_input *input, int fd) {
+    // Reads what fd has available and adds each complete line as an item,
+    // so jobs can start while the command writing the items still runs
+    // At EOF the last line is added even without a newline, and done is set
+    if (input->partial_capacity - input->partial_length < PARALLEL_READ_SIZE) {
+        input->partial_capacity += PARALLEL_READ_SIZE;
+        input->partial = (char *) realloc(input->partial, input->partial_capacity * sizeof(char));
+    }
+    ssize_t bytes = read(fd, &input->partial[input->partial_length], input->partial_capacity - input->partial_length);
+    if (bytes < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (bytes <= 0) {
+        if (bytes < 0) {
+            print_error();
+        }
+        add_parallel_item(input, input->partial, input->partial_length);
+        input->partial_length = 0;
+        input->done = TRUE;
+        return;
+    }
+    // Only the new bytes can hold the end of a line
+    size_t start = 0;
+    size_t k;
+    for (k = input->partial_length; k < input->partial_length + bytes; ++k) {
+        if (input->partial[k] == '\n') {
+            add_parallel_item(input, &input->partial[start], k - start);
+            start = k + 1;
+        }
+    }
+    input->partial_length += bytes - start;
+    memmove(input->partial, &input->partial[start], input->partial_length);
+}
+
+void free_parallel_input(struct parallel_input *input) {
+    size_t k;
+    for (k = 0; k < input->count; ++k) {
+        free(input->items[k]);
+    }
+    free(input->items);
+    free(input->partial);
+}
+
+char **build_job_argv(char **template, int template_count, const char *item) {
+    // Replaces every {} in the template with item, or appends item if the
+    // template has no {}
+    char **argv = (char **) malloc((template_count + 2) * sizeof(char *));
+    size_t item_length = strlen(item);
+    size_t placeholder_length = strlen(PARALLEL_PLACEHOLDER);
+    int found = FALSE;
+    int k;
+    for (k = 0; k < template_count; ++k) {
+        const char *arg = template[k];
+        size_t matches = 0;
+        const char *match = arg;
+        while ((match = strstr(match, PARALLEL_PLACEHOLDER)) != NULL) {
+            ++matches;
+            match += placeholder_length;
+        }
+        if (matches == 0) {
+            argv[k] = strdup(arg);
+            continue;
+        }
+        found = TRUE;
+        argv[k] = (char *) malloc((strlen(arg) + matches * item_length + 1) * sizeof(char));
+        char *out = argv[k];
+        while ((match = strstr(arg, PARALLEL_PLACEHOLDER)) != NULL) {
+            memcpy(out, arg, match - arg);
+            out += match - arg;
+            memcpy(out, item, item_length);
+            out += item_length;
+            arg = match + placeholder_length;
+        }
+        strcpy(out, arg);
+    }
+    int count = template_count;
+    if (!found) {
+        argv[count++] = strdup(item);
+    }
+    argv[count] = NULL;
+    return argv;
+}
+
+int start_parallel_job(struct parallel_job *job, char **template, int template_count, const char *item, int stdin_fd) {
+    // Returns 0 on success, or -1 if the command could not be started
+    int pipes[2];
+    COUNT_STAT(STAT_PIPES, 1);
+    if (pipe2(pipes, O_CLOEXEC) < 0) {
+        print_error();
+        return -1;
+    }
+    char **argv = build_job_argv(template, template_count, item);
+    job->pid = spawn_command_fds(argv, stdin_fd, pipes[1]);
+    int error = errno;
+    char **arg;
+    for (arg = argv; *arg != NULL; ++arg) {
+        free(*arg);
+    }
+    free(argv);
+    close(pipes[1]);
+    if (job->pid < 0) {
+        close(pipes[0]);
+        errno = error;
+        print_error();
+        return -1;
+    }
+    job->out_fd = pipes[0];
+    job->pidfd = open_pidfd(job->pid);
+    job->output = NULL;
+    job->length = 0;
+    job->capacity = 0;
+    job->reaped = FALSE;
+    return 0;
+}
+
+int read_job_output(struct parallel_job *job) {
+    // Appends what the job wrote to its buffer
+    // Returns 0 at EOF, and 1 if there may be more to read
+    if (job->capacity - job->length < PARALLEL_READ_SIZE) {
+        job->capacity = job->capacity ? job->capacity * 2 : PARALLEL_READ_SIZE;
+        job->output = (char *) realloc(job->output, job->capacity * sizeof(char));
+    }
+    ssize_t bytes = read(job->out_fd, &job->output[job->length], job->capacity - job->length);
+    if (bytes < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 1 : 0;
+    }
+    job->length += bytes;
+    return bytes != 0;
+}
+
+void write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t bytes = write(fd, data, length);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += bytes;
+        length -= bytes;
+    }
+}
+
+void parallel_builtin(char **args) {
+    // parallel [-j N] [-k] command [args...] [::: items...]
+    // Runs command once per item (lines of stdin unless ::: is given),
+    // keeping up to N jobs running at once
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int keep_order = FALSE;
+    int k = 0;
+    while (args[k] != NULL && args[k][0] == '-' && args[k][1] != '\0') {
+        if (strcmp(args[k], "-k") == 0) {
+            keep_order = TRUE;
+        }
+        else if (strncmp(args[k], "-j", 2) == 0) {
+            const char *value = args[k][2] != '\0' ? &args[k][2] : args[++k];
+            char *end;
+            if (value == NULL || (max_jobs = strtol(value, &end, 10)) <= 0 || *end != '\0') {
+                fprintf(stderr, "[Error]: parallel: invalid job count\n");
+                cmd_exit_status = 2;
+                cmd_error = CMD_ERROR;
+                return;
+            }
+        }
+        else {
+            break;
+        }
+        ++k;
+    }
+    char **template = &args[k];
+    int template_count = 0;
+    while (template[template_count] != NULL && strcmp(template[template_count], PARALLEL_ITEMS_SEPARATOR) != 0) {
+        ++template_count;
+    }
+    if (template_count == 0) {
+        fprintf(stderr, "[Error]: parallel: usage: parallel [-j N] [-k] command [args...] [::: items...]\n");
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (max_jobs > PARALLEL_MAX_JOBS) {
+        max_jobs = PARALLEL_MAX_JOBS;
+    }
+
+    // Items come from the arguments after :::, or stream in from stdin
+    struct parallel_input input;
+    memset(&input, 0, sizeof(input));
+    int stdin_fd = NO_FD;
+    if (template[template_count] != NULL) {
+        input.items = &template[template_count + 1];
+        while (input.items[input.count] != NULL) {
+            ++input.count;
+        }
+        input.done = TRUE;
+    }
+    else if ((stdin_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+        // The jobs must not read the rest of the shell's input
+        print_error();
+        cmd_error = CMD_ERROR;
+        return;
+    }
+
+    struct parallel_job *jobs = (struct parallel_job *) malloc(max_jobs * sizeof(struct parallel_job));
+    size_t result_capacity = input.count + 1;
+    struct parallel_result *results = (struct parallel_result *) calloc(result_capacity, sizeof(struct parallel_result));
+    struct pollfd *fds = (struct pollfd *) malloc((2 * max_jobs + 2) * sizeof(struct pollfd));
+    int *pids = (int *) malloc(max_jobs * sizeof(int));
+    size_t next_item = 0;
+    size_t next_output = 0;
+    size_t failed = 0;
+    int running = 0;
+    // Flush builtin output before the jobs write anything
+    fflush(stdout);
+    while (TRUE) {
+        if (input.count >= result_capacity) {
+            size_t old_capacity = result_capacity;
+            result_capacity = input.count * 2;
+            results = (struct parallel_result *) realloc(results, result_capacity * sizeof(struct parallel_result));
+            memset(&results[old_capacity], 0, (result_capacity - old_capacity) * sizeof(struct parallel_result));
+        }
+        // Fill the free job slots
+        while (running < max_jobs && next_item < input.count && !interrupted) {
+            struct parallel_job *job = &jobs[running];
+            job->item = next_item++;
+            if (start_parallel_job(job, template, template_count, input.items[job->item], stdin_fd) < 0) {
+                ++failed;
+                results[job->item].done = TRUE;
+                continue;
+            }
+            ++running;
+        }
+        // Print finished output that no longer has to wait for earlier jobs
+        while (next_output < input.count && results[next_output].done) {
+            write_all(STDOUT_FILENO, results[next_output].output, results[next_output].length);
+            free(results[next_output].output);
+            results[next_output].output = NULL;
+            ++next_output;
+        }
+        if (running == 0 && (input.done || interrupted)) {
+            break;
+        }
+
+        // Wait for output, job exits, more items, or SIGINT
+        int fd_count = 0;
+        fds[fd_count].fd = signal_fd;
+        fds[fd_count++].events = POLLIN;
+        // Items are only read ahead of the free job slots, so a fast
+        // producer is slowed down by its pipe instead of filling memory
+        int reading = !input.done && !interrupted && input.count - next_item < (size_t) max_jobs;
+        fds[fd_count].fd = reading ? STDIN_FILENO : NO_FD;
+        fds[fd_count++].events = POLLIN;
+        int j;
+        for (j = 0; j < running; ++j) {
+            pids[j] = jobs[j].pid;
+            fds[fd_count].fd = jobs[j].out_fd;
+            fds[fd_count++].events = POLLIN;
+            // Without a pidfd, SIGCHLD on signal_fd signals the exit instead
+            fds[fd_count].fd = jobs[j].reaped ? NO_FD : jobs[j].pidfd;
+            fds[fd_count++].events = POLLIN;
+        }
+        if (poll(fds, fd_count, -1) < 0 && errno != EINTR) {
+            print_error();
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            handle_signals(pids, running);
+        }
+        if (reading && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            read_parallel_input(&input, STDIN_FILENO);
+        }
+        for (j = 0; j < running; ++j) {
+            struct parallel_job *job = &jobs[j];
+            struct pollfd *out = &fds[2 + 2 * j];
+            if (job->out_fd != NO_FD && (out->revents & (POLLIN | POLLHUP | POLLERR))) {
+                if (!read_job_output(job)) {
+                    close(job->out_fd);
+                    job->out_fd = NO_FD;
+                }
+            }
+            int exited = job->pidfd < 0 || (fds[3 + 2 * j].revents & POLLIN);
+            if (!job->reaped && exited && waitpid(job->pid, &job->status, WNOHANG) == job->pid) {
+                job->reaped = TRUE;
+                if (TRACING) {
+                    trace_process_end(job->pid, job->status);
+                }
+                if (job->pidfd >= 0) {
+                    close(job->pidfd);
+                }
+            }
+        }
+        // Retire jobs that exited and closed their output
+        j = 0;
+        while (j < running) {
+            struct parallel_job *job = &jobs[j];
+            if (!job->reaped || job->out_fd != NO_FD) {
+                ++j;
+                continue;
+            }
+            if (!WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) {
+                ++failed;
+            }
+            if (keep_order) {
+                results[job->item].output = job->output;
+                results[job->item].length = job->length;
+            }
+            else {
+                // Grouped output is printed as soon as the job finishes
+                write_all(STDOUT_FILENO, job->output, job->length);
+                free(job->output);
+            }
+            results[job->item].done = TRUE;
+            jobs[j] = jobs[--running];
+        }
+    }
+    // Items that were never started because of SIGINT are skipped
+    while (next_output < input.count) {
+        free(results[next_output++].output);
+    }
+    size_t item_count = input.count;
+    if (stdin_fd != NO_FD) {
+        close(stdin_fd);
+        free_parallel_input(&input);
+    }
+    free(jobs);
+    free(results);
+    free(fds);
+    free(pids);
+    if (interrupted && next_item < item_count) {
+        failed += item_count - next_item;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "[Error]: parallel: %zu of %zu jobs failed\n", failed, item_count);
+        cmd_exit_status = (failed > PARALLEL_MAX_FAILED) ? PARALLEL_MAX_FAILED + 1 : (int) failed;
+        cmd_error = CMD_ERROR;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "shell.h"
+#include "process.h"
+
+// Constants
+#define PARALLEL_MAX_JOBS 1024
+#define PARALLEL_READ_SIZE 4096
+#define PARALLEL_PLACEHOLDER "{}"
+#define PARALLEL_ITEMS_SEPARATOR ":::"
+// Exit status when more than this many jobs failed
+#define PARALLEL_MAX_FAILED 100
+
+// A job started by parallel; its output is collected and printed in one
+// piece so the output of different jobs never interleaves
+struct parallel_job {
+    int pid;
+    int pidfd;
+    int out_fd;
+    size_t item;
+    char *output;
+    size_t length;
+    size_t capacity;
+    int status;
+    char reaped;
+};
+
+// Output of a finished job, kept until it can be printed in order
+struct parallel_result {
+    char *output;
+    size_t length;
+    char done;
+};
+
+// Items of parallel; read from stdin, they are added as lines arrive
+struct parallel_input {
+    char **items;
+    size_t count;
+    size_t capacity;
+    // Bytes read after the last newline
+    char *partial;
+    size_t partial_length;
+    size_t partial_capacity;
+    // Every item is known
+    char done;
+};
+
+// Function type signatures
+void parallel_builtin(char **args);
+void read_parallel_input(struct parallel_input *input, int fd);
+void free_parallel_input(struct parallel_input *input);
+char **build_job_argv(char **template, int template_count, const char *item);
+int start_parallel_job(struct parallel_job *job, char **template, int template_count, const char *item, int stdin_fd);
+int read_job_output(struct parallel_job *job);
+void write_all(int fd, const char *data, size_t length);
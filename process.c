@@ -0,0 +1,405 @@
+#include "process.h"
+#include "trace.h"
+#include "rlimits.h"
+#include "affinity.h"
+#include "timeout.h"
+#include "stats.h"
+
+int signal_fd = NO_FD;
+// Children started for the earlier stages of the current pipeline
+int pipeline_pids[MAX_PIPELINE_CHILDREN];
+int pipeline_child_count = 0;
+// Process substitutions that haven't been reaped yet; the ones from
+// process_substitution_base on belong to the innermost running script
+struct process_substitution process_substitutions[MAX_PROCESS_SUBSTITUTIONS];
+int process_substitution_count = 0;
+int process_substitution_base = 0;
+// Coprocesses, including ones that exited but haven't been closed yet
+struct coprocess coprocesses[MAX_COPROCESSES];
+int coprocess_count = 0;
+
+void init_event_loop() {
+    // SIGINT and SIGCHLD are only ever read from signal_fd, so nothing
+    // happens inside a signal handler
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        print_error();
+        exit(1);
+    }
+    if ((signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        print_error();
+        exit(1);
+    }
+    // Builtins writing to a closed pipe get EPIPE instead of killing the shell
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void reset_child_signals() {
+    // Undo init_event_loop() in a child that won't run the event loop
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    if (signal_fd != NO_FD) {
+        close(signal_fd);
+        signal_fd = NO_FD;
+    }
+}
+
+int open_pidfd(int pid) {
+    // Returns -1 if the kernel has no pidfd support
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int spawn_command(char **argv) {
+    return spawn_command_fds(argv, NO_FD, NO_FD);
+}
+
+int spawn_command_fds(char **argv, int stdin_fd, int stdout_fd) {
+    // Forks and execs argv, returning the pid of the child
+    // stdin_fd and stdout_fd replace the child's stdin and stdout unless NO_FD
+    // Returns -1 and sets errno to the fork or exec error on failure
+    long long trace_start = TRACING ? trace_now() : 0;
+    int status_pipes[2];
+    COUNT_STAT(STAT_PIPES, 1);
+    if (pipe2(status_pipes, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    COUNT_STAT(STAT_FORKS, 1);
+    int pid = fork();
+    if (pid < 0) {
+        int error = errno;
+        close(status_pipes[0]);
+        close(status_pipes[1]);
+        errno = error;
+        return -1;
+    }
+    if (!pid) {
+        close(status_pipes[0]);
+        reset_child_signals();
+        if ((stdin_fd != NO_FD && dup2(stdin_fd, STDIN_FILENO) < 0)
+            || (stdout_fd != NO_FD && dup2(stdout_fd, STDOUT_FILENO) < 0)
+            || apply_child_limits() < 0
+            || apply_child_placement() < 0) {
+            int error = errno;
+            write(status_pipes[1], &error, sizeof(error));
+            _exit(EXEC_FAIL_EXIT_CODE);
+        }
+        COUNT_STAT(STAT_EXECS, 1);
+        execvp(argv[0], argv);
+        // Only reached if exec failed; the status pipe closes on a
+        // successful exec, so the parent reads either errno or EOF
+        int error = errno;
+        write(status_pipes[1], &error, sizeof(error));
+        _exit(error == ENOENT ? EXEC_NOT_FOUND_EXIT_CODE : EXEC_FAIL_EXIT_CODE);
+    }
+    close(status_pipes[1]);
+    if (child_placement.active) {
+        // The next stage or job gets the next CPU when spreading
+        ++child_placement.next_stage;
+    }
+    int error;
+    ssize_t bytes;
+    do {
+        bytes = read(status_pipes[0], &error, sizeof(error));
+    } while (bytes < 0 && errno == EINTR);
+    close(status_pipes[0]);
+    if (TRACING) {
+        // From fork() until the exec succeeded or failed
+        char detail[TRACE_DETAIL_MAX_SIZE];
+        trace_join_argv(argv, detail, sizeof(detail));
+        trace_span("spawn", "spawn", trace_start, pid, detail, bytes == sizeof(error) ? error : 0);
+    }
+    if (bytes == sizeof(error)) {
+        waitpid(pid, NULL, 0);
+        errno = error;
+        return -1;
+    }
+    if (TRACING) {
+        trace_process_start(pid, argv);
+    }
+    child_pid = pid;
+    return pid;
+}
+
+int exec_in_place(char **argv) {
+    // Replaces the shell with argv, for the last command of input that the
+    // shell exits after, instead of forking a child and waiting for it
+    // Only returns on failure, with errno set; by then the shell is no longer
+    // set up to wait for children, so all it can do is report and exit
+    // Output still buffered by builtins and the exit-time stats are written
+    // now, since exec discards them
+    fflush(NULL);
+    COUNT_STAT(STAT_EXECS, 1);
+    dump_stats();
+    reset_child_signals();
+    if (apply_child_limits() < 0 || apply_child_placement() < 0) {
+        return -1;
+    }
+    execvp(argv[0], argv);
+    return -1;
+}
+
+int set_pipe_size(int fd, long size) {
+    // Resizes a pipe, capping size at the limit for unprivileged users
+    // Returns the new capacity, or -1 on error
+    static long max_size = 0;
+    if (max_size == 0) {
+        FILE *limit_file = fopen(PIPE_MAX_SIZE_FILE, "r");
+        if (limit_file == NULL || fscanf(limit_file, "%ld", &max_size) != 1) {
+            // The default limit
+            max_size = 1 << 20;
+        }
+        if (limit_file != NULL) {
+            fclose(limit_file);
+        }
+    }
+    if (size > max_size) {
+        size = max_size;
+    }
+    int capacity = fcntl(fd, F_SETPIPE_SZ, (int) size);
+    if (capacity < 0) {
+        print_error();
+    }
+    return capacity;
+}
+
+void add_pipeline_child(int pid) {
+    if (pipeline_child_count == MAX_PIPELINE_CHILDREN) {
+        // Too many stages to track; wait for the oldest one now
+        int status;
+        wait_for_children(pipeline_pids, &status, 1);
+        memmove(pipeline_pids, &pipeline_pids[1], (MAX_PIPELINE_CHILDREN - 1) * sizeof(int));
+        --pipeline_child_count;
+    }
+    pipeline_pids[pipeline_child_count++] = pid;
+}
+
+int wait_for_pipeline(int last_pid, int *last_status) {
+    // Waits for the pending pipeline stages and, if last_pid is positive,
+    // the final stage, whose wait status is stored in last_status
+    int pids[MAX_PIPELINE_CHILDREN + 1];
+    int statuses[MAX_PIPELINE_CHILDREN + 1];
+    int count = pipeline_child_count;
+    memcpy(pids, pipeline_pids, count * sizeof(int));
+    if (last_pid > 0) {
+        pids[count++] = last_pid;
+    }
+    pipeline_child_count = 0;
+    if (count == 0) {
+        return 0;
+    }
+    if (wait_for_children(pids, statuses, count) < 0) {
+        return -1;
+    }
+    if (last_pid > 0) {
+        *last_status = statuses[count - 1];
+    }
+    return 0;
+}
+
+int add_process_substitution(int pid, int fd) {
+    if (process_substitution_count == MAX_PROCESS_SUBSTITUTIONS) {
+        return -1;
+    }
+    process_substitutions[process_substitution_count].pid = pid;
+    process_substitutions[process_substitution_count].fd = fd;
+    ++process_substitution_count;
+    return 0;
+}
+
+void finish_process_substitutions(int first, char wait) {
+    // Closes the shell's ends of the pipes from first on, so that <(cmd)
+    // sees SIGPIPE and >(cmd) sees EOF, and optionally waits for them
+    int pids[MAX_PROCESS_SUBSTITUTIONS];
+    int statuses[MAX_PROCESS_SUBSTITUTIONS];
+    int count = 0;
+    int k;
+    for (k = first; k < process_substitution_count; ++k) {
+        if (process_substitutions[k].fd != NO_FD) {
+            close(process_substitutions[k].fd);
+            process_substitutions[k].fd = NO_FD;
+        }
+        pids[count++] = process_substitutions[k].pid;
+    }
+    if (!wait || count == 0) {
+        return;
+    }
+    // Like other shells, their exit statuses are ignored
+    wait_for_children(pids, statuses, count);
+    process_substitution_count = first;
+}
+
+struct coprocess *find_coprocess(const char *name) {
+    int k;
+    for (k = 0; k < coprocess_count; ++k) {
+        if (strcmp(coprocesses[k].name, name) == 0) {
+            return &coprocesses[k];
+        }
+    }
+    return NULL;
+}
+
+struct coprocess *add_coprocess(const char *name, int pid, int in_fd, int out_fd) {
+    // Returns NULL if the table is full
+    if (coprocess_count == MAX_COPROCESSES) {
+        return NULL;
+    }
+    struct coprocess *coprocess = &coprocesses[coprocess_count++];
+    snprintf(coprocess->name, sizeof(coprocess->name), "%s", name);
+    coprocess->pid = pid;
+    coprocess->in_fd = in_fd;
+    coprocess->out_fd = out_fd;
+    coprocess->status = 0;
+    coprocess->running = TRUE;
+    return coprocess;
+}
+
+void close_coprocess(struct coprocess *coprocess) {
+    // Closes the shell's ends of the pipes, so the coprocess sees EOF, and
+    // waits for it to exit
+    if (coprocess->in_fd != NO_FD) {
+        close(coprocess->in_fd);
+        coprocess->in_fd = NO_FD;
+    }
+    if (coprocess->out_fd != NO_FD) {
+        close(coprocess->out_fd);
+        coprocess->out_fd = NO_FD;
+    }
+    if (coprocess->running) {
+        // Not running as far as reap_coprocesses() is concerned, so only
+        // this wait reaps it
+        coprocess->running = FALSE;
+        int pid = coprocess->pid;
+        wait_for_children(&pid, &coprocess->status, 1);
+    }
+}
+
+void remove_coprocess(struct coprocess *coprocess) {
+    *coprocess = coprocesses[--coprocess_count];
+}
+
+void reap_coprocesses() {
+    // Collects coprocesses that exited on their own, so they don't linger as
+    // zombies; their pipes stay open until they are closed
+    int k;
+    for (k = 0; k < coprocess_count; ++k) {
+        if (coprocesses[k].running && waitpid(coprocesses[k].pid, &coprocesses[k].status, WNOHANG) == coprocesses[k].pid) {
+            coprocesses[k].running = FALSE;
+            if (TRACING) {
+                trace_process_end(coprocesses[k].pid, coprocesses[k].status);
+            }
+        }
+    }
+}
+
+int wait_for_children(int *pids, int *statuses, int count) {
+    // Blocks in ppoll() until every child has exited, forwarding SIGINT and
+    // waking up for the deadline of a timeout prefix
+    long long trace_start = TRACING ? trace_now() : 0;
+    struct pollfd fds[count + 1];
+    fds[0].fd = signal_fd;
+    fds[0].events = POLLIN;
+    int remaining = count;
+    int k;
+    for (k = 0; k < count; ++k) {
+        // Without pidfd support, SIGCHLD on signal_fd wakes the loop instead
+        fds[k + 1].fd = open_pidfd(pids[k]);
+        fds[k + 1].events = POLLIN;
+    }
+    while (TRUE) {
+        for (k = 0; k < count; ++k) {
+            if (pids[k] > 0 && waitpid(pids[k], &statuses[k], WNOHANG) == pids[k]) {
+                if (TRACING) {
+                    trace_process_end(pids[k], statuses[k]);
+                }
+                // Mark the child as reaped
+                pids[k] = -pids[k];
+                if (fds[k + 1].fd >= 0) {
+                    close(fds[k + 1].fd);
+                }
+                fds[k + 1].fd = NO_FD;
+                --remaining;
+            }
+        }
+        if (remaining == 0) {
+            break;
+        }
+        struct timespec timeout_left;
+        if (ppoll(fds, count + 1, command_timeout_remaining(&timeout_left), NULL) < 0 && errno != EINTR) {
+            print_error();
+            // Give back the pidfds and unmark the children reaped so far
+            for (k = 0; k < count; ++k) {
+                if (fds[k + 1].fd >= 0) {
+                    close(fds[k + 1].fd);
+                }
+                if (pids[k] < 0) {
+                    pids[k] = -pids[k];
+                }
+            }
+            return -1;
+        }
+        if (fds[0].revents & POLLIN) {
+            handle_signals(pids, count);
+        }
+        expire_command_timeout(pids, count);
+    }
+    for (k = 0; k < count; ++k) {
+        pids[k] = -pids[k];
+    }
+    if (TRACING) {
+        char detail[TRACE_DETAIL_MAX_SIZE];
+        size_t index = 0;
+        detail[0] = '\0';
+        for (k = 0; k < count && index < sizeof(detail); ++k) {
+            index += snprintf(&detail[index], sizeof(detail) - index, k ? " %d" : "%d", pids[k]);
+        }
+        int status = statuses[count - 1];
+        trace_span("wait", "wait", trace_start, getpid(), detail,
+                   WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    }
+    return 0;
+}
+
+void handle_signals(int *pids, int count) {
+    // Reads every pending signal from signal_fd
+    // SIGINT is forwarded to the children being waited for, or to the
+    // readline process if there are none
+    if (signal_fd == NO_FD) {
+        return;
+    }
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) {
+            reap_coprocesses();
+            continue;
+        }
+        if (info.ssi_signo != SIGINT) {
+            continue;
+        }
+        interrupted = TRUE;
+        int forwarded = FALSE;
+        int k;
+        for (k = 0; k < count; ++k) {
+            if (pids[k] > 0 && pids[k] != rl_child_pid) {
+                kill(pids[k], SIGINT);
+                forwarded = TRUE;
+            }
+        }
+        if (!forwarded && rl_child_pid) {
+            // Kill readline process to refresh prompt
+            kill(rl_child_pid, SIGINT);
+        }
+    }
+}
+
+void check_signals() {
+    // Non-blocking check for SIGINT while no child is running
+    handle_signals(NULL, 0);
+}
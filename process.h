@@ -0,0 +1,63 @@
+#pragma once
+#include "shell.h"
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+// Constants
+#define MAX_PIPELINE_CHILDREN 64
+#define MAX_PROCESS_SUBSTITUTIONS 64
+#define MAX_COPROCESSES 16
+#define COPROCESS_NAME_MAX_SIZE 64
+#define EXEC_NOT_FOUND_EXIT_CODE 127
+#define EXEC_FAIL_EXIT_CODE 126
+#define PIPE_MAX_SIZE_FILE "/proc/sys/fs/pipe-max-size"
+
+// A <(cmd) or >(cmd) child and the shell's end of its pipe, which stays
+// open until the command using it has finished
+struct process_substitution {
+    int pid;
+    int fd;
+};
+
+// A child started by coproc that stays around for many commands; the shell
+// writes to in_fd (its stdin) and reads from out_fd (its stdout)
+struct coprocess {
+    char name[COPROCESS_NAME_MAX_SIZE];
+    int pid;
+    int in_fd;
+    int out_fd;
+    // Wait status, once it has exited and been reaped
+    int status;
+    char running;
+};
+
+// Function type signatures
+void init_event_loop();
+void reset_child_signals();
+int open_pidfd(int pid);
+int spawn_command(char **argv);
+int spawn_command_fds(char **argv, int stdin_fd, int stdout_fd);
+int exec_in_place(char **argv);
+int set_pipe_size(int fd, long size);
+void add_pipeline_child(int pid);
+int wait_for_pipeline(int last_pid, int *last_status);
+int wait_for_children(int *pids, int *statuses, int count);
+int add_process_substitution(int pid, int fd);
+void finish_process_substitutions(int first, char wait);
+struct coprocess *find_coprocess(const char *name);
+struct coprocess *add_coprocess(const char *name, int pid, int in_fd, int out_fd);
+void close_coprocess(struct coprocess *coprocess);
+void remove_coprocess(struct coprocess *coprocess);
+void reap_coprocesses();
+void handle_signals(int *pids, int count);
+void check_signals();
+
+// Variables
+extern int signal_fd;
+extern int pipeline_child_count;
+extern struct process_substitution process_substitutions[MAX_PROCESS_SUBSTITUTIONS];
+extern int process_substitution_count;
+extern int process_substitution_base;
+extern struct coprocess coprocesses[MAX_COPROCESSES];
+extern int coprocess_count;
@@ -1,4 +1,6 @@
 #include "prompt.h"
+#include "stats.h"
+#include "options.h"
 
 void abbreviate_home(char *full_path, size_t full_path_length) {
     // Replace $HOME with ~ in full_path
@@ -30,7 +32,7 @@ char *get_uid_symbol() {
     const char non_root = '$';
     const char root = '#';
     if (getuid() != 0) {
-        if (cmd_error == CMD_ERROR) {
+        if (CMD_FAILED(cmd_error)) {
             int required_size = sizeof(char) * (strlen(bold_prefix) + strlen(fg_red_160) + 1 + strlen(reset) + 1);
             uid_symbol = (char *) malloc(required_size);
             sprintf(uid_symbol, "%s%s%c%s", bold_prefix, fg_red_160, non_root, reset);
@@ -65,16 +67,20 @@ char *get_time_str(char *time_str_container) {
 void git_branch(char *container, size_t container_size) {
     char *l_opts[3] = {"git", "branch", NULL};
     int pipes[2];
+    COUNT_STAT(STAT_PIPES, 1);
     if (pipe(pipes) < 0) { // Returns -1 if error
         print_error();
         return;
     }
     // Fork to execute command
+    COUNT_STAT(STAT_FORKS, 1);
+    COUNT_STAT(STAT_GIT_FORKS, 1);
     child_pid = fork();
     if (!child_pid) {
         dup2(pipes[1], STDOUT_FILENO);
         close(pipes[0]);
         freopen("/dev/null", "w", stderr); // Redirect stderr to /dev/null
+        COUNT_STAT(STAT_EXECS, 1);
         if (execvp(l_opts[0], l_opts) < 0) { // Returns -1 if error
             container[0] = '\0';
         }
@@ -115,16 +121,20 @@ void git_status(char *container, size_t container_size) {
     }
     char *l_opts[3] = {"git", "status", NULL};
     int pipes[2];
+    COUNT_STAT(STAT_PIPES, 1);
     if (pipe(pipes) < 0) { // Returns -1 if error
         print_error();
         return;
     }
     // Fork to execute command
+    COUNT_STAT(STAT_FORKS, 1);
+    COUNT_STAT(STAT_GIT_FORKS, 1);
     child_pid = fork();
     if (!child_pid) {
         dup2(pipes[1], STDOUT_FILENO);
         close(pipes[0]);
         freopen("/dev/null", "w", stderr); // Redirect stderr to /dev/null
+        COUNT_STAT(STAT_EXECS, 1);
         if (execvp(l_opts[0], l_opts) < 0) { // Returns -1 if error
             container[0] = '\0';
         }
@@ -150,7 +160,7 @@ void git_status(char *container, size_t container_size) {
             container_index += strlen(check) + 1;
         }
         if (strstr(output, "Changes not staged for commit") != NULL) {
-            sprintf(container, "%s %s", container, delta);
+            sprintf(&container[container_index], " %s", delta);
             container_index += strlen(delta) + 1;
         }
         container[container_index] = '\0';
@@ -160,6 +170,10 @@ void git_status(char *container, size_t container_size) {
 }
 
 char *git() {
+#ifdef SHIP_NO_GIT_PROMPT
+    // Saves forking git twice for every prompt
+    return strdup("");
+#else
     char *git_branch_container = (char *) malloc(GIT_BRANCH_MAX_SIZE * sizeof(char));
     int container_size = GIT_BRANCH_MAX_SIZE + GIT_STATUS_MAX_SIZE;
     char *git_container = (char *) malloc(container_size * sizeof(char));
@@ -174,6 +188,57 @@ char *git() {
     }
     free(git_branch_container);
     return git_container;
+#endif
+}
+
+void format_duration(long long nanoseconds, char *container, size_t container_size) {
+    // 850ms, 4.2s, 3m07s, or 2h05m
+    long long ms = nanoseconds / 1000000;
+    if (ms < 1000) {
+        snprintf(container, container_size, "%lldms", ms);
+    }
+    else if (ms < 60 * 1000) {
+        snprintf(container, container_size, "%lld.%llds", ms / 1000, ms % 1000 / 100);
+    }
+    else if (ms < 60 * 60 * 1000) {
+        snprintf(container, container_size, "%lldm%02llds", ms / (60 * 1000), ms / 1000 % 60);
+    }
+    else {
+        snprintf(container, container_size, "%lldh%02lldm", ms / (60 * 60 * 1000), ms / (60 * 1000) % 60);
+    }
+}
+
+char *get_status_segment() {
+    // How long the last line took, if it was at least prompt_duration
+    // milliseconds, and its exit status, or the signal that killed it
+    char *segment = (char *) malloc(STATUS_SEGMENT_MAX_SIZE * sizeof(char));
+    segment[0] = '\0';
+    if (!last_command.ran) {
+        return segment;
+    }
+    size_t length = 0;
+    long long elapsed = last_command.end - last_command.start;
+    if (elapsed / 1000000 >= get_option(OPT_PROMPT_DURATION)) {
+        char duration[DURATION_MAX_SIZE];
+        format_duration(elapsed, duration, sizeof(duration));
+        length += snprintf(segment, STATUS_SEGMENT_MAX_SIZE, " %s%s%s%s", bold_prefix, fg_yellow_214, duration, reset);
+    }
+    if (last_exit_status != 0 && length < STATUS_SEGMENT_MAX_SIZE) {
+        // A signal only names the status if the status came from it, and not
+        // from a timeout or a later builtin
+        int status = last_command.wait_status;
+        const char *signal_name = NULL;
+        if (last_command.waited && WIFSIGNALED(status) && last_exit_status == 128 + WTERMSIG(status)) {
+            signal_name = sigabbrev_np(WTERMSIG(status));
+        }
+        if (signal_name != NULL) {
+            snprintf(&segment[length], STATUS_SEGMENT_MAX_SIZE - length, " %s%sSIG%s%s", bold_prefix, fg_red_160, signal_name, reset);
+        }
+        else {
+            snprintf(&segment[length], STATUS_SEGMENT_MAX_SIZE - length, " %s%s%d%s", bold_prefix, fg_red_160, last_exit_status, reset);
+        }
+    }
+    return segment;
 }
 
 void get_prompt(char *prompt, int prompt_max_size) {
@@ -192,9 +257,15 @@ void get_prompt(char *prompt, int prompt_max_size) {
     hostname[255] = '\0';
     gethostname(hostname, sizeof(hostname));
     char *git_container = git();
-    snprintf(prompt, prompt_max_size, "%s%s[%s]%s %s%s%s%s%s%s@%s%s%s%s:%s%s%s%s%s %s%s%s%s %s\n%s%s>>%s ", bold_prefix, fg_red_196, time_str, reset, bold_prefix, fg_bright_green, get_user(), reset, bold_prefix, fg_blue_24, hostname, reset, bold_prefix, fg_bright_green, reset, bold_prefix, fg_blue_39, cwd, reset, bold_prefix, fg_green, git_container, reset, uid_symbol, bold_prefix, fg_green, reset);
+    char *status_segment = get_status_segment();
+    snprintf(prompt, prompt_max_size, "%s%s[%s]%s %s%s%s%s%s%s@%s%s%s%s:%s%s%s%s%s %s%s%s%s%s %s\n%s%s>>%s ", bold_prefix, fg_red_196, time_str, reset, bold_prefix, fg_bright_green, get_user(), reset, bold_prefix, fg_blue_24, hostname, reset, bold_prefix, fg_bright_green, reset, bold_prefix, fg_blue_39, cwd, reset, bold_prefix, fg_green, git_container, reset, status_segment, uid_symbol, bold_prefix, fg_green, reset);
     free(git_container);
+    free(status_segment);
     free(uid_symbol);
     free(time_str);
 }
 
+void get_continuation_prompt(char *prompt, int prompt_max_size) {
+    // Shown while an unfinished control statement is being entered
+    snprintf(prompt, prompt_max_size, "%s%s>%s ", bold_prefix, fg_green, reset);
+}
@@ -6,9 +6,12 @@
 #define TIME_MAX_SIZE 50
 #define GIT_BRANCH_MAX_SIZE 128
 #define GIT_STATUS_MAX_SIZE 50
+#define DURATION_MAX_SIZE 32
+#define STATUS_SEGMENT_MAX_SIZE 128
 
 // ANSI Escape codes (wrapped with \001 and \002 so readline ignores
 // non-printing characters when calculating prompt size)
+#ifndef SHIP_NO_COLOR
 static const char *reset = "\001\e[0m\002";
 static const char *bold_prefix = "\001\e[1;\002";
 static const char *dim_prefix = "\001\e[2;\002";
@@ -20,6 +23,21 @@ static const char *fg_red_160 = "\00138;5;160m\002";
 static const char *fg_white = "\00138;5;15m\002";
 static const char *fg_bright_green = "\00138;5;118m\002";
 static const char *fg_green = "\00138;5;34m\002";
+static const char *fg_yellow_214 = "\00138;5;214m\002";
+#else
+static const char *reset = "";
+static const char *bold_prefix = "";
+static const char *dim_prefix = "";
+static const char *underline_prefix = "";
+static const char *fg_blue_39 = "";
+static const char *fg_blue_24 = "";
+static const char *fg_red_196 = "";
+static const char *fg_red_160 = "";
+static const char *fg_white = "";
+static const char *fg_bright_green = "";
+static const char *fg_green = "";
+static const char *fg_yellow_214 = "";
+#endif
 
 // UTF-8
 static const char *cross = "\001\xe2\x9c\x98\002";
@@ -34,5 +52,8 @@ char *get_time_str(char *time_str_container);
 void git_branch(char *container, size_t container_size);
 void git_status(char *container, size_t container_size);
 char *git();
+void format_duration(long long nanoseconds, char *container, size_t container_size);
+char *get_status_segment();
 void get_prompt(char *prompt, int prompt_max_size);
+void get_continuation_prompt(char *prompt, int prompt_max_size);
 
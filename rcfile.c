@@ -0,0 +1,348 @@
+#include "rcfile.h"
+
+int source_rc_file() {
+    // Sources $SHIPRC, or ~/.shiprc, if it exists
+    char path[RC_PATH_MAX_SIZE];
+    const char *rc_path = getenv(RC_FILE_ENV_VAR);
+    if (rc_path == NULL) {
+        if (home == NULL) {
+            return SOURCE_FAILED;
+        }
+        snprintf(path, sizeof(path), "%s/%s", home, RC_FILE_NAME);
+        rc_path = path;
+    }
+    if (access(rc_path, F_OK) < 0) {
+        return SOURCE_FAILED;
+    }
+    return source_file(rc_path, TRUE);
+}
+
+int source_file(const char *path, int use_cache) {
+    // Runs the commands in a file in the current shell
+    // With use_cache, the parsed commands are cached in path.cache
+    struct stat source_stat;
+    if (stat(path, &source_stat) < 0) {
+        print_error();
+        return SOURCE_FAILED;
+    }
+    char cache_path[RC_PATH_MAX_SIZE];
+    snprintf(cache_path, sizeof(cache_path), "%s%s", path, RC_CACHE_SUFFIX);
+    struct script_node *script = NULL;
+    int result = SOURCE_PARSED;
+    if (use_cache && (script = load_script_cache(cache_path, &source_stat)) != NULL) {
+        result = SOURCE_CACHED;
+    }
+    else {
+        size_t length;
+        char *text = read_file(path, &length);
+        if (text == NULL) {
+            print_error();
+            return SOURCE_FAILED;
+        }
+        int status;
+        script = parse_script(text, &status);
+        free(text);
+        if (status != SCRIPT_OK) {
+            if (status == SCRIPT_INCOMPLETE) {
+                fprintf(stderr, "[Error]: %s: Unexpected end of file.\n", path);
+            }
+            cmd_error = CMD_ERROR;
+            last_exit_status = 2;
+            return SOURCE_FAILED;
+        }
+        if (use_cache) {
+            save_script_cache(cache_path, &source_stat, script);
+        }
+    }
+    cmd_error = CMD_BLANK;
+    run_script(script);
+    free_script(script);
+    return result;
+}
+
+void source_builtin(char **args) {
+    if (args[0] == NULL) {
+        fprintf(stderr, "[Error]: source: filename argument required\n");
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (source_file(args[0], FALSE) == SOURCE_FAILED) {
+        cmd_exit_status = last_exit_status ? last_exit_status : 1;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    cmd_exit_status = last_exit_status;
+    cmd_error = last_exit_status ? CMD_ERROR : CMD_OKAY;
+}
+
+char *read_file(const char *path, size_t *length) {
+    // Returns the null-terminated contents of a file, or NULL on error
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t capacity = file_stat.st_size;
+    char *data = (char *) malloc((capacity + 1) * sizeof(char));
+    size_t total = 0;
+    while (total < capacity) {
+        ssize_t bytes = read(fd, &data[total], capacity - total);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        total += bytes;
+    }
+    close(fd);
+    data[total] = '\0';
+    *length = total;
+    return data;
+}
+
+// The cache is the header followed by each node list in preorder; every
+// node is prefixed by a 1 byte and every list ends with a 0 byte
+
+static void write_u32(FILE *file, uint32_t value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+static void write_string(FILE *file, const char *s) {
+    if (s == NULL) {
+        write_u32(file, RC_CACHE_NULL_STRING);
+        return;
+    }
+    uint32_t length = strlen(s);
+    write_u32(file, length);
+    fwrite(s, 1, length, file);
+}
+
+static void write_node_list(FILE *file, struct script_node *node) {
+    for (; node != NULL; node = node->next) {
+        fputc(1, file);
+        fputc(node->type, file);
+        fputc(node->redir_mode, file);
+        write_string(file, node->text);
+        // The words split at parse time are stored, so nothing is re-tokenized
+        fputc(node->words != NULL, file);
+        if (node->words != NULL) {
+            write_u32(file, node->word_count);
+            int k;
+            for (k = 0; k < node->word_count; ++k) {
+                fputc(node->word_is_var[k], file);
+                write_string(file, node->words[k]);
+            }
+        }
+        write_string(file, node->var_name);
+        write_node_list(file, node->condition);
+        write_node_list(file, node->body);
+        write_node_list(file, node->else_body);
+        write_node_list(file, node->word_list);
+        write_node_list(file, node->redir_target);
+        struct case_item *item;
+        for (item = node->case_items; item != NULL; item = item->next) {
+            fputc(1, file);
+            write_node_list(file, item->patterns);
+            write_node_list(file, item->body);
+        }
+        fputc(0, file);
+    }
+    fputc(0, file);
+}
+
+void save_script_cache(const char *cache_path, const struct stat *source_stat, struct script_node *script) {
+    // Written to a temporary file and renamed, so shells starting at the
+    // same time never read a partial cache
+    char temp_path[RC_PATH_MAX_SIZE];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", cache_path, (int) getpid());
+    FILE *file = fopen(temp_path, "we");
+    if (file == NULL) {
+        return;
+    }
+    struct rc_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RC_CACHE_MAGIC, sizeof(header.magic));
+    header.version = RC_CACHE_VERSION;
+    header.node_size = sizeof(struct script_node);
+    header.mtime_sec = source_stat->st_mtim.tv_sec;
+    header.mtime_nsec = source_stat->st_mtim.tv_nsec;
+    header.size = source_stat->st_size;
+    fwrite(&header, sizeof(header), 1, file);
+    write_node_list(file, script);
+    if (fclose(file) != 0 || rename(temp_path, cache_path) < 0) {
+        unlink(temp_path);
+    }
+}
+
+static int read_byte(struct rc_cache_reader *reader) {
+    if (reader->pos >= reader->length) {
+        reader->failed = TRUE;
+        return 0;
+    }
+    return (unsigned char) reader->data[reader->pos++];
+}
+
+static uint32_t read_u32(struct rc_cache_reader *reader) {
+    uint32_t value = 0;
+    if (reader->length - reader->pos < sizeof(value)) {
+        reader->failed = TRUE;
+        reader->pos = reader->length;
+        return 0;
+    }
+    memcpy(&value, &reader->data[reader->pos], sizeof(value));
+    reader->pos += sizeof(value);
+    return value;
+}
+
+static char *read_string(struct rc_cache_reader *reader) {
+    uint32_t length = read_u32(reader);
+    if (length == RC_CACHE_NULL_STRING || reader->failed) {
+        return NULL;
+    }
+    if (reader->length - reader->pos < length) {
+        reader->failed = TRUE;
+        reader->pos = reader->length;
+        return NULL;
+    }
+    char *s = strndup(&reader->data[reader->pos], length);
+    reader->pos += length;
+    return s;
+}
+
+static int is_word_node(const struct script_node *node) {
+    // Word lists, case patterns and redirection targets are one simple node
+    return node != NULL && node->type == NODE_SIMPLE && node->next == NULL;
+}
+
+static int is_valid_node(const struct script_node *node) {
+    // Checks a node read from the cache against what the parser can produce,
+    // so a corrupt cache is reparsed instead of being run
+    // Its children were checked when they were read
+    if (node->type < NODE_SIMPLE || node->type > NODE_FUNCTION_DEF
+        || node->redir_mode < REDIR_NONE || node->redir_mode > REDIR_STDIN
+        || (node->redir_mode != REDIR_NONE) != is_word_node(node->redir_target)) {
+        return FALSE;
+    }
+    if (node->type == NODE_SIMPLE) {
+        if (node->text == NULL || node->var_name != NULL || node->condition != NULL || node->body != NULL
+            || node->else_body != NULL || node->word_list != NULL || node->case_items != NULL) {
+            return FALSE;
+        }
+        int k;
+        for (k = 0; node->words != NULL && k < node->word_count; ++k) {
+            if (node->words[k] == NULL || (node->word_is_var[k] != FALSE && node->word_is_var[k] != TRUE)) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    if (node->words != NULL || (node->case_items != NULL && node->type != NODE_CASE)) {
+        return FALSE;
+    }
+    switch (node->type) {
+        case NODE_IF:
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            return node->condition != NULL;
+        case NODE_FOR:
+            return node->var_name != NULL && (node->word_list == NULL || is_word_node(node->word_list));
+        case NODE_CASE: {
+            const struct case_item *item;
+            for (item = node->case_items; item != NULL; item = item->next) {
+                if (!is_word_node(item->patterns)) {
+                    return FALSE;
+                }
+            }
+            return is_word_node(node->word_list);
+        }
+        case NODE_FUNCTION_DEF:
+            return node->var_name != NULL && node->body != NULL && node->body->type != NODE_SIMPLE;
+    }
+    // NODE_GROUP
+    return TRUE;
+}
+
+static struct script_node *read_node_list(struct rc_cache_reader *reader) {
+    struct script_node *head = NULL;
+    struct script_node **tail = &head;
+    while (!reader->failed && read_byte(reader) == 1) {
+        struct script_node *node = (struct script_node *) calloc(1, sizeof(struct script_node));
+        *tail = node;
+        tail = &node->next;
+        node->type = read_byte(reader);
+        node->redir_mode = read_byte(reader);
+        node->text = read_string(reader);
+        if (read_byte(reader)) {
+            uint32_t count = read_u32(reader);
+            if (count > reader->length - reader->pos) {
+                // More words than bytes left; the cache is corrupt
+                reader->failed = TRUE;
+                break;
+            }
+            node->word_count = count;
+            node->words = (char **) calloc(count + 1, sizeof(char *));
+            node->word_is_var = (char *) malloc((count + 1) * sizeof(char));
+            node->exec_argv = (char **) malloc((count + 1) * sizeof(char *));
+            uint32_t k;
+            for (k = 0; k < count && !reader->failed; ++k) {
+                node->word_is_var[k] = read_byte(reader);
+                node->words[k] = read_string(reader);
+            }
+        }
+        node->var_name = read_string(reader);
+        node->condition = read_node_list(reader);
+        node->body = read_node_list(reader);
+        node->else_body = read_node_list(reader);
+        node->word_list = read_node_list(reader);
+        node->redir_target = read_node_list(reader);
+        struct case_item **item_tail = &node->case_items;
+        while (!reader->failed && read_byte(reader) == 1) {
+            *item_tail = (struct case_item *) calloc(1, sizeof(struct case_item));
+            (*item_tail)->patterns = read_node_list(reader);
+            (*item_tail)->body = read_node_list(reader);
+            item_tail = &(*item_tail)->next;
+        }
+        if (!reader->failed && !is_valid_node(node)) {
+            reader->failed = TRUE;
+        }
+    }
+    return head;
+}
+
+struct script_node *load_script_cache(const char *cache_path, const struct stat *source_stat) {
+    // Returns the cached commands, or NULL if the cache is missing or stale
+    size_t length;
+    char *data = read_file(cache_path, &length);
+    if (data == NULL) {
+        return NULL;
+    }
+    struct rc_cache_header header;
+    if (length < sizeof(header)) {
+        free(data);
+        return NULL;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, RC_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != RC_CACHE_VERSION
+        || header.node_size != sizeof(struct script_node)
+        || header.mtime_sec != source_stat->st_mtim.tv_sec
+        || header.mtime_nsec != source_stat->st_mtim.tv_nsec
+        || header.size != source_stat->st_size) {
+        free(data);
+        return NULL;
+    }
+    struct rc_cache_reader reader = {data, length, sizeof(header), FALSE};
+    struct script_node *script = read_node_list(&reader);
+    free(data);
+    if (reader.failed || reader.pos != length) {
+        free_script(script);
+        return NULL;
+    }
+    return script;
+}
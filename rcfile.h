@@ -0,0 +1,46 @@
+#pragma once
+#include "shell.h"
+#include "script.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Constants
+#define RC_FILE_NAME ".shiprc"
+#define RC_FILE_ENV_VAR "SHIPRC"
+#define RC_CACHE_SUFFIX ".cache"
+#define RC_CACHE_MAGIC "SHIPRC\x01"
+#define RC_CACHE_VERSION 1
+#define RC_PATH_MAX_SIZE 4096
+// Marks a NULL string in the cache
+#define RC_CACHE_NULL_STRING UINT32_MAX
+
+// Results of source_file()
+#define SOURCE_FAILED -1
+#define SOURCE_PARSED 0
+#define SOURCE_CACHED 1
+
+// Identifies the rc file a cache was written for
+struct rc_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+};
+
+// Read position in a cache file loaded into memory
+struct rc_cache_reader {
+    const char *data;
+    size_t length;
+    size_t pos;
+    int failed;
+};
+
+// Function type signatures
+int source_rc_file();
+int source_file(const char *path, int use_cache);
+void source_builtin(char **args);
+char *read_file(const char *path, size_t *length);
+struct script_node *load_script_cache(const char *cache_path, const struct stat *source_stat);
+void save_script_cache(const char *cache_path, const struct stat *source_stat, struct script_node *script);
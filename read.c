@@ -0,0 +1,276 @@
+#include "read.h"
+#include "process.h"
+#include "variables.h"
+#include <poll.h>
+#include <sys/ioctl.h>
+
+static struct read_buffer read_buffers[READ_BUFFER_COUNT];
+static int next_read_buffer = 0;
+
+static struct read_buffer *find_read_buffer(int fd, const struct stat *info) {
+    // Returns the buffer of the file open on fd, or recycles one for it
+    int k;
+    for (k = 0; k < READ_BUFFER_COUNT; ++k) {
+        if (read_buffers[k].data != NULL && read_buffers[k].fd == fd
+            && read_buffers[k].dev == info->st_dev && read_buffers[k].ino == info->st_ino) {
+            return &read_buffers[k];
+        }
+    }
+    struct read_buffer *buffer = &read_buffers[next_read_buffer];
+    next_read_buffer = (next_read_buffer + 1) % READ_BUFFER_COUNT;
+    if (buffer->data == NULL) {
+        buffer->data = (char *) malloc(READ_BUFFER_SIZE * sizeof(char));
+    }
+    buffer->fd = fd;
+    buffer->dev = info->st_dev;
+    buffer->ino = info->st_ino;
+    buffer->start = buffer->end = 0;
+    return buffer;
+}
+
+int open_read_source(struct read_source *source, int fd) {
+    // Regular files are read a block at a time, with the offset moved back to
+    // the end of the record afterwards, so commands run in the meantime
+    // (like the body of a while read loop) start reading where read stopped
+    // Pipes and terminals can't be given back what was read too far, so they
+    // are read a byte at a time
+    // Returns -1 with errno set if fd can't be read
+    struct stat info;
+    source->fd = fd;
+    source->buffer = NULL;
+    source->available = 0;
+    if (fstat(fd, &info) < 0) {
+        return -1;
+    }
+    off_t offset;
+    if (!S_ISREG(info.st_mode) || (offset = lseek(fd, 0, SEEK_CUR)) < 0) {
+        return 0;
+    }
+    struct read_buffer *buffer = find_read_buffer(fd, &info);
+    if (buffer->offset != offset || buffer->mtime.tv_sec != info.st_mtim.tv_sec
+        || buffer->mtime.tv_nsec != info.st_mtim.tv_nsec) {
+        // Something else moved the offset, or the file changed
+        buffer->start = buffer->end = 0;
+    }
+    buffer->offset = offset;
+    buffer->mtime = info.st_mtim;
+    source->buffer = buffer;
+    return 0;
+}
+
+void close_read_source(struct read_source *source) {
+    if (source->buffer != NULL) {
+        lseek(source->fd, source->buffer->offset, SEEK_SET);
+    }
+}
+
+int read_source_byte(struct read_source *source, char *byte) {
+    // Returns 1, 0 at the end of the input, or -1 with errno set (EINTR
+    // after SIGINT)
+    struct read_buffer *buffer = source->buffer;
+    if (buffer != NULL) {
+        if (buffer->start == buffer->end) {
+            // pread() leaves the offset alone until close_read_source()
+            ssize_t bytes;
+            while ((bytes = pread(source->fd, buffer->data, READ_BUFFER_SIZE, buffer->offset)) < 0 && errno == EINTR);
+            if (bytes <= 0) {
+                return bytes;
+            }
+            buffer->start = 0;
+            buffer->end = bytes;
+        }
+        *byte = buffer->data[buffer->start++];
+        ++buffer->offset;
+        return 1;
+    }
+    while (source->available == 0) {
+        // SIGINT only arrives through signal_fd, so a blocking read() would
+        // never be interrupted
+        int available;
+        if (ioctl(source->fd, FIONREAD, &available) == 0 && available > 0) {
+            source->available = available;
+            break;
+        }
+        struct pollfd fds[2] = {{source->fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (fds[1].revents & POLLIN) {
+            check_signals();
+            if (interrupted) {
+                errno = EINTR;
+                return -1;
+            }
+        }
+        if (fds[0].revents) {
+            // Readable, or at the end (which FIONREAD reports as 0)
+            source->available = 1;
+        }
+    }
+    ssize_t bytes;
+    while ((bytes = read(source->fd, byte, 1)) < 0 && errno == EINTR);
+    if (bytes == 1) {
+        --source->available;
+    }
+    return bytes;
+}
+
+static void add_to_read_record(struct read_record *record, char c, char escaped) {
+    if (record->length + 1 >= record->capacity) {
+        record->capacity = record->capacity ? record->capacity * 2 : 128;
+        record->text = (char *) realloc(record->text, record->capacity * sizeof(char));
+        record->escaped = (char *) realloc(record->escaped, record->capacity * sizeof(char));
+    }
+    record->escaped[record->length] = escaped;
+    record->text[record->length++] = c;
+    record->text[record->length] = '\0';
+}
+
+int read_record(struct read_source *source, struct read_record *record, int delimiter, long limit, char raw) {
+    // Reads up to delimiter, or limit characters if limit is not negative
+    // Without raw, \ escapes the next character and \ newline continues the
+    // record on the next line
+    // Returns 1 if the record is complete, 0 at the end of the input, or -1
+    // with errno set
+    char c;
+    int result;
+    while (limit < 0 || (long) record->length < limit) {
+        if ((result = read_source_byte(source, &c)) <= 0) {
+            return result;
+        }
+        if (c == '\\' && !raw) {
+            if ((result = read_source_byte(source, &c)) <= 0) {
+                return result;
+            }
+            if (c != '\n') {
+                add_to_read_record(record, c, TRUE);
+            }
+            continue;
+        }
+        if (c == delimiter) {
+            return 1;
+        }
+        add_to_read_record(record, c, FALSE);
+    }
+    return 1;
+}
+
+static int is_read_separator(const struct read_record *record, size_t index) {
+    return !record->escaped[index] && strchr(READ_FIELD_SEPARATORS, record->text[index]) != NULL;
+}
+
+void assign_read_fields(const struct read_record *record, char **names, int count) {
+    // Splits the record into fields at whitespace; the last name gets the
+    // rest of the record, and names without a field are set to ""
+    // Without names, $REPLY gets the whole record
+    const char *text = record->text ? record->text : "";
+    if (count == 0) {
+        set_var_n(READ_DEFAULT_VAR, text, record->length);
+        return;
+    }
+    size_t index = 0;
+    int k;
+    for (k = 0; k < count; ++k) {
+        while (index < record->length && is_read_separator(record, index)) {
+            ++index;
+        }
+        size_t start = index;
+        size_t end;
+        if (k == count - 1) {
+            end = record->length;
+            while (end > start && is_read_separator(record, end - 1)) {
+                --end;
+            }
+        }
+        else {
+            while (index < record->length && !is_read_separator(record, index)) {
+                ++index;
+            }
+            end = index;
+        }
+        set_var_n(names[k], &text[start], end - start);
+    }
+}
+
+void read_builtin(char **args, int count) {
+    // read [-r] [-d DELIM] [-n COUNT] [-u FD] [NAME...]
+    // Reads a line (or up to DELIM, or COUNT characters) from stdin or FD
+    // and splits it into the NAMEs; fails at the end of the input
+    int delimiter = '\n';
+    long limit = -1;
+    int fd = STDIN_FILENO;
+    char raw = FALSE;
+    const char *error = NULL;
+    int k = 0;
+    while (error == NULL && k < count && args[k][0] == '-' && args[k][1] != '\0') {
+        char *end;
+        if (strcmp(args[k], "--") == 0) {
+            ++k;
+            break;
+        }
+        if (strcmp(args[k], "-r") == 0) {
+            raw = TRUE;
+        }
+        else if (strcmp(args[k], "-d") == 0) {
+            if (k + 1 >= count) {
+                error = "-d needs a delimiter";
+            }
+            else {
+                // An empty delimiter reads up to a NUL
+                delimiter = (unsigned char) args[++k][0];
+            }
+        }
+        else if (strcmp(args[k], "-n") == 0) {
+            if (k + 1 >= count || (limit = strtol(args[++k], &end, 10)) < 0 || *end != '\0') {
+                error = "-n needs a number of characters";
+            }
+        }
+        else if (strcmp(args[k], "-u") == 0) {
+            if (k + 1 >= count || (fd = strtol(args[++k], &end, 10)) < 0 || *end != '\0') {
+                error = "-u needs a file descriptor";
+            }
+        }
+        else {
+            error = "invalid option";
+        }
+        ++k;
+    }
+    int j;
+    for (j = k; error == NULL && j < count; ++j) {
+        if (var_name_length(args[j]) != strlen(args[j]) || args[j][0] == '\0') {
+            error = "invalid variable name";
+        }
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: read: %s\n", error);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+
+    struct read_source source;
+    struct read_record record = {NULL, NULL, 0, 0};
+    if (open_read_source(&source, fd) < 0) {
+        fprintf(stderr, "[Error]: read: %d: %s\n", fd, strerror(errno));
+        cmd_exit_status = 1;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    int result = read_record(&source, &record, delimiter, limit, raw);
+    int read_error = errno;
+    close_read_source(&source);
+    if (result < 0 && read_error != EINTR) {
+        fprintf(stderr, "[Error]: read: %s\n", strerror(read_error));
+    }
+    // What was read before the end of the input is still assigned, like
+    // other shells
+    if (result >= 0) {
+        assign_read_fields(&record, &args[k], count - k);
+    }
+    free(record.text);
+    free(record.escaped);
+    if (result <= 0) {
+        cmd_exit_status = 1;
+        cmd_error = CMD_ERROR;
+    }
+}
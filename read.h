@@ -0,0 +1,51 @@
+#pragma once
+#include "shell.h"
+#include <sys/stat.h>
+
+// Constants
+#define READ_DEFAULT_VAR "REPLY"
+#define READ_BUFFER_SIZE 65536
+// Files read by read at the same time, like a loop reading one file while
+// its body reads another
+#define READ_BUFFER_COUNT 4
+#define READ_FIELD_SEPARATORS " \t\n"
+
+// Data read ahead from a regular file; it is only reused while the file and
+// its offset are still where the last read left them
+struct read_buffer {
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    // File offset of data[start]
+    off_t offset;
+    char *data;
+    size_t start;
+    size_t end;
+};
+
+// Where read gets its bytes from: a read_buffer, or single bytes when the fd
+// may be shared with other processes (pipes, terminals)
+struct read_source {
+    int fd;
+    struct read_buffer *buffer;
+    // Bytes that can be read from a pipe or terminal without blocking
+    int available;
+};
+
+// A record with the characters that were escaped with \, which are never
+// field separators
+struct read_record {
+    char *text;
+    char *escaped;
+    size_t length;
+    size_t capacity;
+};
+
+// Function type signatures
+void read_builtin(char **args, int count);
+int open_read_source(struct read_source *source, int fd);
+void close_read_source(struct read_source *source);
+int read_source_byte(struct read_source *source, char *byte);
+int read_record(struct read_source *source, struct read_record *record, int delimiter, long limit, char raw);
+void assign_read_fields(const struct read_record *record, char **names, int count);
@@ -0,0 +1,265 @@
+#include "rlimits.h"
+#include "functions.h"
+#include "process.h"
+#include "stats.h"
+
+static const struct resource_limit resource_limits[] = {
+    {'c', RLIMIT_CORE, "core file size (bytes)"},
+    {'d', RLIMIT_DATA, "data seg size (bytes)"},
+    {'f', RLIMIT_FSIZE, "file size (bytes)"},
+    {'l', RLIMIT_MEMLOCK, "max locked memory (bytes)"},
+    {'m', RLIMIT_AS, "memory (bytes)"},
+    {'n', RLIMIT_NOFILE, "open files"},
+    {'s', RLIMIT_STACK, "stack size (bytes)"},
+    {'t', RLIMIT_CPU, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, "max user processes"},
+    {'v', RLIMIT_AS, "virtual memory (bytes)"},
+};
+#define RESOURCE_LIMIT_COUNT (sizeof(resource_limits) / sizeof(resource_limits[0]))
+
+// Limits for the next spawned command, set by the limit built-in
+struct child_limit child_limits[MAX_CHILD_LIMITS];
+int child_limit_count = 0;
+
+const struct resource_limit *find_resource_limit(char flag) {
+    size_t k;
+    for (k = 0; k < RESOURCE_LIMIT_COUNT; ++k) {
+        if (resource_limits[k].flag == flag) {
+            return &resource_limits[k];
+        }
+    }
+    return NULL;
+}
+
+int parse_limit_value(const char *text, rlim_t *value) {
+    // Accepts "unlimited" or a size with an optional K, M, or G suffix
+    if (strcmp(text, RLIMIT_UNLIMITED) == 0) {
+        *value = RLIM_INFINITY;
+        return 0;
+    }
+    long size;
+    if (parse_size(text, &size) < 0) {
+        return -1;
+    }
+    *value = size;
+    return 0;
+}
+
+void print_limit(const struct resource_limit *limit, int hard, int show_name) {
+    struct rlimit current;
+    if (getrlimit(limit->resource, &current) < 0) {
+        print_error();
+        return;
+    }
+    rlim_t value = hard ? current.rlim_max : current.rlim_cur;
+    if (show_name) {
+        printf("%-28s (-%c) ", limit->description, limit->flag);
+    }
+    if (value == RLIM_INFINITY) {
+        printf("%s\n", RLIMIT_UNLIMITED);
+    }
+    else {
+        printf("%llu\n", (unsigned long long) value);
+    }
+}
+
+void ulimit_builtin(char **args) {
+    // ulimit [-S | -H] [-a | -FLAG [value]]
+    // Sets both the soft and hard limit unless -S or -H is given
+    int soft = FALSE;
+    int hard = FALSE;
+    const struct resource_limit *limit = find_resource_limit('f');
+    int k = 0;
+    for (; args[k] != NULL && args[k][0] == '-' && args[k][1] != '\0' && args[k][2] == '\0'; ++k) {
+        char flag = args[k][1];
+        if (flag == 'S') {
+            soft = TRUE;
+        }
+        else if (flag == 'H') {
+            hard = TRUE;
+        }
+        else if (flag == 'a') {
+            size_t j;
+            for (j = 0; j < RESOURCE_LIMIT_COUNT; ++j) {
+                print_limit(&resource_limits[j], hard, TRUE);
+            }
+            return;
+        }
+        else if ((limit = find_resource_limit(flag)) == NULL) {
+            fprintf(stderr, "[Error]: ulimit: -%c: invalid option\n", flag);
+            cmd_exit_status = 2;
+            cmd_error = CMD_ERROR;
+            return;
+        }
+    }
+    if (args[k] == NULL) {
+        print_limit(limit, hard, FALSE);
+        return;
+    }
+    rlim_t value;
+    if (parse_limit_value(args[k], &value) < 0) {
+        fprintf(stderr, "[Error]: ulimit: %s: invalid limit\n", args[k]);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (!soft && !hard) {
+        soft = hard = TRUE;
+    }
+    struct rlimit current;
+    getrlimit(limit->resource, &current);
+    if (soft) {
+        current.rlim_cur = value;
+    }
+    if (hard) {
+        current.rlim_max = value;
+    }
+    if (setrlimit(limit->resource, &current) < 0) {
+        print_error();
+        cmd_exit_status = 1;
+        cmd_error = CMD_ERROR;
+    }
+}
+
+void limit_builtin(char **args, int count) {
+    // limit [-FLAG value]... command [args...]
+    // Runs command with the limits applied only to it
+    int k = 0;
+    child_limit_count = 0;
+    while (k < count && args[k][0] == '-' && args[k][1] != '\0' && args[k][2] == '\0') {
+        const struct resource_limit *limit = find_resource_limit(args[k][1]);
+        rlim_t value;
+        if (limit == NULL || k + 1 >= count || parse_limit_value(args[k + 1], &value) < 0
+            || child_limit_count == MAX_CHILD_LIMITS) {
+            fprintf(stderr, "[Error]: limit: usage: limit [-FLAG value]... command [args...]\n");
+            child_limit_count = 0;
+            cmd_exit_status = 2;
+            cmd_error = CMD_ERROR;
+            return;
+        }
+        child_limits[child_limit_count].resource = limit->resource;
+        child_limits[child_limit_count++].value = value;
+        k += 2;
+    }
+    if (k == count) {
+        fprintf(stderr, "[Error]: limit: usage: limit [-FLAG value]... command [args...]\n");
+        child_limit_count = 0;
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    if (is_builtin(args[k])) {
+        fprintf(stderr, "[Error]: limit: %s: cannot limit a built-in\n", args[k]);
+        child_limit_count = 0;
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    struct shell_function *function = find_function(args[k]);
+    if (function != NULL) {
+        // Functions run in the shell, so give them a process to limit
+        int pid;
+        if (in_pipeline) {
+            // Started like any other stage; the last stage waits for it
+            pid = fork_pipeline_stage();
+        }
+        else {
+            COUNT_STAT(STAT_FORKS, 1);
+            pid = fork();
+            if (pid < 0) {
+                print_error();
+                cmd_error = CMD_ERROR;
+            }
+            else if (!pid) {
+                // The earlier stages of the pipeline are the shell's children
+                pipeline_child_count = 0;
+            }
+        }
+        if (!pid) {
+            if (apply_child_limits() < 0) {
+                print_error();
+                exit(1);
+            }
+            call_function(function, &args[k + 1], count - k - 1);
+            fflush(stdout);
+            exit(cmd_exit_status);
+        }
+        else if (pid > 0 && !in_pipeline) {
+            int status;
+            release_pipeline_input();
+            if (wait_for_pipeline(pid, &status) == 0) {
+                record_wait_status(status);
+            }
+        }
+        child_limit_count = 0;
+        return;
+    }
+    // Run the rest of the line as the command; spawn_command() applies the
+    // limits in the child
+    char **saved_opts = opts;
+    int saved_count = optCount;
+    opts = &args[k];
+    optCount = count - k;
+    execute();
+    opts = saved_opts;
+    optCount = saved_count;
+    child_limit_count = 0;
+}
+
+int apply_child_limits() {
+    // Called in the child between fork and exec
+    // Returns -1 with errno set if a limit could not be set
+    int k;
+    for (k = 0; k < child_limit_count; ++k) {
+        struct rlimit current;
+        if (getrlimit(child_limits[k].resource, &current) < 0) {
+            return -1;
+        }
+        rlim_t value = child_limits[k].value;
+        if (current.rlim_max != RLIM_INFINITY && (value == RLIM_INFINITY || value > current.rlim_max)) {
+            // Only root can raise a hard limit
+            value = current.rlim_max;
+        }
+        struct rlimit limit = {value, value};
+        if (child_limits[k].resource == RLIMIT_CPU && value != RLIM_INFINITY
+            && (current.rlim_max == RLIM_INFINITY || value < current.rlim_max)) {
+            // Leave a second between SIGXCPU and SIGKILL, so the overrun is
+            // reported as a limit rather than a plain kill
+            limit.rlim_max = value + 1;
+        }
+        if (setrlimit(child_limits[k].resource, &limit) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const char *limit_exceeded_reason(int status) {
+    // Returns why a command was stopped by a resource limit, or NULL
+    if (!WIFSIGNALED(status)) {
+        return NULL;
+    }
+    int k;
+    switch (WTERMSIG(status)) {
+        case SIGXCPU:
+            return "CPU time limit exceeded";
+        case SIGXFSZ:
+            return "File size limit exceeded";
+        case SIGKILL:
+        case SIGSEGV:
+        case SIGABRT:
+        case SIGBUS:
+            // Only blame a limit that was set for this command
+            for (k = 0; k < child_limit_count; ++k) {
+                if (WTERMSIG(status) == SIGKILL && child_limits[k].resource == RLIMIT_CPU) {
+                    return "CPU time limit exceeded";
+                }
+                if (WTERMSIG(status) != SIGKILL
+                    && (child_limits[k].resource == RLIMIT_AS || child_limits[k].resource == RLIMIT_DATA
+                        || child_limits[k].resource == RLIMIT_STACK)) {
+                    return "Memory limit exceeded";
+                }
+            }
+    }
+    return NULL;
+}
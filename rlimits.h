@@ -0,0 +1,34 @@
+#pragma once
+#include "shell.h"
+#include "options.h"
+#include <sys/resource.h>
+
+// Constants
+#define MAX_CHILD_LIMITS 16
+#define RLIMIT_UNLIMITED "unlimited"
+
+// A resource that ulimit and limit know about
+struct resource_limit {
+    char flag;
+    int resource;
+    const char *description;
+};
+
+// A limit to set in the child before exec
+struct child_limit {
+    int resource;
+    rlim_t value;
+};
+
+// Function type signatures
+const struct resource_limit *find_resource_limit(char flag);
+int parse_limit_value(const char *text, rlim_t *value);
+void print_limit(const struct resource_limit *limit, int hard, int show_name);
+void ulimit_builtin(char **args);
+void limit_builtin(char **args, int count);
+int apply_child_limits();
+const char *limit_exceeded_reason(int status);
+
+// Variables
+extern struct child_limit child_limits[MAX_CHILD_LIMITS];
+extern int child_limit_count;
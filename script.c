@@ -0,0 +1,996 @@
+#include "script.h"
+#include "variables.h"
+#include "functions.h"
+#include "process.h"
+#include "trace.h"
+#include "lexer.h"
+
+int loop_depth = 0;
+int break_levels = 0;
+int continue_levels = 0;
+// The last command of input that the shell exits after, which may exec in
+// place of the shell
+static struct script_node *tail_node = NULL;
+
+// Parser position, shared by the recursive descent functions below
+static const char *src;
+static size_t pos;
+static int parse_status;
+
+static const char *reserved_words[] = {"then", "elif", "else", "fi", "do", "done", "esac", "}", NULL};
+static const char *terms_then[] = {"then", NULL};
+static const char *terms_if_body[] = {"elif", "else", "fi", NULL};
+static const char *terms_fi[] = {"fi", NULL};
+static const char *terms_do[] = {"do", NULL};
+static const char *terms_done[] = {"done", NULL};
+static const char *terms_esac[] = {"esac", NULL};
+static const char *terms_group[] = {"}", NULL};
+
+static struct script_node *parse_list(const char **terminators);
+
+static struct script_node *new_node(char type) {
+    struct script_node *node = (struct script_node *) calloc(1, sizeof(struct script_node));
+    node->type = type;
+    return node;
+}
+
+static void syntax_error(const char *message) {
+    if (parse_status == SCRIPT_OK) {
+        fprintf(stderr, "[Error]: Syntax error: %s\n", message);
+        parse_status = SCRIPT_SYNTAX_ERROR;
+    }
+}
+
+static void skip_blanks() {
+    while (src[pos] == ' ' || src[pos] == '\t') {
+        ++pos;
+    }
+    // Comments run until the end of the line
+    if (src[pos] == '#') {
+        while (src[pos] && src[pos] != '\n') {
+            ++pos;
+        }
+    }
+}
+
+static void skip_separators() {
+    while (TRUE) {
+        skip_blanks();
+        if (src[pos] == '\n' || (src[pos] == ';' && src[pos + 1] != ';')) {
+            ++pos;
+        }
+        else {
+            return;
+        }
+    }
+}
+
+static size_t skip_quoted(size_t index) {
+    // index points at an opening quote or backtick; returns the index of
+    // the matching closing one
+    char quote = src[index++];
+    while (src[index] && src[index] != quote) {
+        if (src[index] == '\\' && quote != '\'' && src[index + 1]) {
+            ++index;
+        }
+        ++index;
+    }
+    if (!src[index]) {
+        parse_status = SCRIPT_INCOMPLETE;
+        return index - 1;
+    }
+    return index;
+}
+
+static size_t word_end(size_t index, int in_case_pattern) {
+    // Returns the index just past the word starting at index
+    int depth = 0;
+    while (TRUE) {
+        // Only special characters matter here
+        index += lex_scan_plain(&src[index]);
+        char c = src[index];
+        if (!c) {
+            break;
+        }
+        if (depth == 0 && (c == ' ' || c == '\t' || c == '\n' || c == ';')) {
+            break;
+        }
+        if (depth == 0 && in_case_pattern && (c == '|' || c == ')' || c == '(')) {
+            break;
+        }
+        if (c == '\\' && src[index + 1]) {
+            ++index;
+        }
+        else if (c == '\'' || c == '"' || c == '`') {
+            index = skip_quoted(index);
+        }
+        else if ((c == '$' || c == '<' || c == '>') && src[index + 1] == '(') {
+            ++depth;
+            ++index;
+        }
+        else if (c == '(' && depth > 0) {
+            ++depth;
+        }
+        else if (c == ')' && depth > 0) {
+            --depth;
+        }
+        ++index;
+    }
+    if (depth > 0) {
+        parse_status = SCRIPT_INCOMPLETE;
+    }
+    return index;
+}
+
+static int word_is(size_t index, const char *keyword) {
+    size_t length = strlen(keyword);
+    return strncmp(&src[index], keyword, length) == 0 && word_end(index, FALSE) == index + length;
+}
+
+static int word_in(size_t index, const char **words) {
+    int j;
+    for (j = 0; words[j] != NULL; ++j) {
+        if (word_is(index, words[j])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static int expect(const char *keyword) {
+    skip_separators();
+    if (!src[pos]) {
+        parse_status = SCRIPT_INCOMPLETE;
+        return FALSE;
+    }
+    if (!word_is(pos, keyword)) {
+        char message[64];
+        snprintf(message, sizeof(message), "expected '%s'", keyword);
+        syntax_error(message);
+        return FALSE;
+    }
+    pos += strlen(keyword);
+    return TRUE;
+}
+
+static void pretokenize(struct script_node *node) {
+    // Split the text into words now if executing it needs no parse_input()
+    const char *text = node->text;
+    size_t index = 0;
+    int count = 0;
+    char **words = (char **) malloc((strlen(text) / 2 + 2) * sizeof(char *));
+    char *word_is_var = (char *) malloc((strlen(text) / 2 + 2) * sizeof(char));
+    while (TRUE) {
+        while (text[index] == ' ' || text[index] == '\t') {
+            ++index;
+        }
+        if (!text[index]) {
+            break;
+        }
+        size_t start = index;
+        char is_var = FALSE;
+        size_t name_start = index;
+        size_t name_length = 0;
+        if (text[index] == '$') {
+            // Only a whole-word $NAME or ${NAME} is allowed
+            int braced = (text[index + 1] == '{');
+            name_start = index + 1 + braced;
+            name_length = var_name_length(&text[name_start]);
+            index = name_start + name_length;
+            if (name_length == 0 || (braced && text[index++] != '}')) {
+                break;
+            }
+            is_var = TRUE;
+        }
+        else {
+            // Characters that parse_input() copies into tokens unchanged
+            while (!lex_is_word_break(text[index])) {
+                index += 1 + lex_scan_plain(&text[index + 1]);
+            }
+        }
+        if (text[index] && text[index] != ' ' && text[index] != '\t') {
+            break;
+        }
+        if (is_var) {
+            words[count] = strndup(&text[name_start], name_length);
+        }
+        else {
+            words[count] = strndup(&text[start], index - start);
+        }
+        word_is_var[count++] = is_var;
+    }
+    if (text[index]) {
+        // Not plain; leave it to parse_input()
+        while (count > 0) {
+            free(words[--count]);
+        }
+        free(words);
+        free(word_is_var);
+        return;
+    }
+    node->words = words;
+    node->word_is_var = word_is_var;
+    node->word_count = count;
+    node->exec_argv = (char **) malloc((count + 1) * sizeof(char *));
+}
+
+static struct script_node *new_simple(char *text) {
+    // Takes ownership of text
+    struct script_node *node = new_node(NODE_SIMPLE);
+    node->text = text;
+    pretokenize(node);
+    return node;
+}
+
+static char *trimmed_text(size_t start, size_t end) {
+    while (end > start && (src[end - 1] == ' ' || src[end - 1] == '\t')) {
+        --end;
+    }
+    return strndup(&src[start], end - start);
+}
+
+static struct script_node *make_simple(size_t start, size_t end) {
+    return new_simple(trimmed_text(start, end));
+}
+
+static struct script_node *make_command(size_t start, size_t end) {
+    // Aliases are expanded once here, when the command is parsed
+    char *text = trimmed_text(start, end);
+    char *expanded = expand_alias(text);
+    if (expanded != NULL) {
+        free(text);
+        text = expanded;
+    }
+    return new_simple(text);
+}
+
+static struct script_node *parse_simple() {
+    size_t start = pos;
+    while (src[pos] && src[pos] != '\n' && src[pos] != ';') {
+        if (src[pos] == '#' && (pos == start || src[pos - 1] == ' ' || src[pos - 1] == '\t')) {
+            size_t end = pos;
+            while (src[pos] && src[pos] != '\n') {
+                ++pos;
+            }
+            return make_command(start, end);
+        }
+        pos = word_end(pos, FALSE);
+        while (src[pos] == ' ' || src[pos] == '\t') {
+            ++pos;
+        }
+    }
+    return make_command(start, pos);
+}
+
+static int parse_redirection(struct script_node *node) {
+    // Optional redirection following a compound command
+    skip_blanks();
+    if (src[pos] == '>' && src[pos + 1] == '>') {
+        node->redir_mode = REDIR_APPEND_STDOUT;
+        pos += 2;
+    }
+    else if (src[pos] == '>') {
+        node->redir_mode = REDIR_STDOUT;
+        ++pos;
+    }
+    else if (src[pos] == '<') {
+        node->redir_mode = REDIR_STDIN;
+        ++pos;
+    }
+    if (node->redir_mode != REDIR_NONE) {
+        skip_blanks();
+        size_t start = pos;
+        pos = word_end(pos, FALSE);
+        if (pos == start) {
+            syntax_error("missing redirection target");
+            return FALSE;
+        }
+        node->redir_target = make_simple(start, pos);
+        skip_blanks();
+    }
+    if (src[pos] && src[pos] != '\n' && src[pos] != ';') {
+        syntax_error(src[pos] == '|' ? "pipes after compound commands are not supported" : "unexpected text after compound command");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int parse_if_clause(struct script_node *node) {
+    // Parses everything after "if" or "elif", up to and including "fi"
+    node->condition = parse_list(terms_then);
+    if (parse_status != SCRIPT_OK || !expect("then")) {
+        return FALSE;
+    }
+    node->body = parse_list(terms_if_body);
+    if (parse_status != SCRIPT_OK) {
+        return FALSE;
+    }
+    skip_separators();
+    if (word_is(pos, "elif")) {
+        pos += strlen("elif");
+        // An elif is an else branch holding a nested if
+        node->else_body = new_node(NODE_IF);
+        return parse_if_clause(node->else_body);
+    }
+    if (word_is(pos, "else")) {
+        pos += strlen("else");
+        node->else_body = parse_list(terms_fi);
+        if (parse_status != SCRIPT_OK) {
+            return FALSE;
+        }
+    }
+    return expect("fi");
+}
+
+static int parse_loop(struct script_node *node) {
+    node->condition = parse_list(terms_do);
+    if (parse_status != SCRIPT_OK || !expect("do")) {
+        return FALSE;
+    }
+    node->body = parse_list(terms_done);
+    return parse_status == SCRIPT_OK && expect("done");
+}
+
+static int parse_for(struct script_node *node) {
+    skip_blanks();
+    size_t name_length = var_name_length(&src[pos]);
+    if (name_length == 0 || word_end(pos, FALSE) != pos + name_length) {
+        syntax_error("invalid for loop variable");
+        return FALSE;
+    }
+    node->var_name = strndup(&src[pos], name_length);
+    pos += name_length;
+    skip_blanks();
+    if (word_is(pos, "in")) {
+        pos += strlen("in");
+        skip_blanks();
+        size_t start = pos;
+        while (src[pos] && src[pos] != '\n' && src[pos] != ';') {
+            pos = word_end(pos, FALSE);
+            skip_blanks();
+        }
+        node->word_list = make_simple(start, pos);
+    }
+    if (!expect("do")) {
+        return FALSE;
+    }
+    node->body = parse_list(terms_done);
+    return parse_status == SCRIPT_OK && expect("done");
+}
+
+static int parse_case(struct script_node *node) {
+    skip_blanks();
+    size_t start = pos;
+    pos = word_end(pos, FALSE);
+    if (pos == start) {
+        syntax_error("missing case word");
+        return FALSE;
+    }
+    node->word_list = make_simple(start, pos);
+    if (!expect("in")) {
+        return FALSE;
+    }
+    struct case_item **tail = &node->case_items;
+    while (TRUE) {
+        skip_separators();
+        if (!src[pos]) {
+            parse_status = SCRIPT_INCOMPLETE;
+            return FALSE;
+        }
+        if (word_is(pos, "esac")) {
+            pos += strlen("esac");
+            return TRUE;
+        }
+        if (src[pos] == '(') {
+            ++pos;
+        }
+        // Collect the '|' separated patterns as a space separated word list
+        char *patterns = (char *) malloc((strlen(&src[pos]) + 1) * sizeof(char));
+        patterns[0] = '\0';
+        while (TRUE) {
+            skip_blanks();
+            size_t pattern_start = pos;
+            pos = word_end(pos, TRUE);
+            strncat(patterns, &src[pattern_start], pos - pattern_start);
+            skip_blanks();
+            if (src[pos] != '|') {
+                break;
+            }
+            strcat(patterns, " ");
+            ++pos;
+        }
+        if (src[pos] != ')') {
+            free(patterns);
+            if (!src[pos]) {
+                parse_status = SCRIPT_INCOMPLETE;
+            }
+            syntax_error("expected ')' after case pattern");
+            return FALSE;
+        }
+        ++pos;
+        struct case_item *item = (struct case_item *) calloc(1, sizeof(struct case_item));
+        item->patterns = new_simple(patterns);
+        *tail = item;
+        tail = &item->next;
+        item->body = parse_list(terms_esac);
+        if (parse_status != SCRIPT_OK) {
+            return FALSE;
+        }
+        if (src[pos] == ';' && src[pos + 1] == ';') {
+            pos += 2;
+        }
+    }
+}
+
+static int is_function_definition() {
+    // NAME() or NAME ()
+    size_t index = pos + var_name_length(&src[pos]);
+    if (index == pos) {
+        return FALSE;
+    }
+    while (src[index] == ' ' || src[index] == '\t') {
+        ++index;
+    }
+    if (src[index] != '(') {
+        return FALSE;
+    }
+    ++index;
+    while (src[index] == ' ' || src[index] == '\t') {
+        ++index;
+    }
+    return src[index] == ')';
+}
+
+static struct script_node *parse_command();
+
+static struct script_node *parse_function_definition() {
+    struct script_node *node = new_node(NODE_FUNCTION_DEF);
+    size_t name_length = var_name_length(&src[pos]);
+    node->var_name = strndup(&src[pos], name_length);
+    pos = strchr(&src[pos], ')') - src + 1;
+    skip_separators();
+    if (!src[pos]) {
+        parse_status = SCRIPT_INCOMPLETE;
+        free_script(node);
+        return NULL;
+    }
+    // The body is any compound command, usually a { ... } group
+    node->body = parse_command();
+    if (node->body == NULL || node->body->type == NODE_SIMPLE) {
+        syntax_error("function body must be a compound command");
+        free_script(node);
+        return NULL;
+    }
+    return node;
+}
+
+static struct script_node *parse_command() {
+    skip_blanks();
+    struct script_node *node = NULL;
+    int ok = TRUE;
+    if (word_is(pos, "{")) {
+        ++pos;
+        node = new_node(NODE_GROUP);
+        node->body = parse_list(terms_group);
+        ok = parse_status == SCRIPT_OK && expect("}");
+    }
+    else if (is_function_definition()) {
+        return parse_function_definition();
+    }
+    else if (word_is(pos, "if")) {
+        pos += strlen("if");
+        node = new_node(NODE_IF);
+        ok = parse_if_clause(node);
+    }
+    else if (word_is(pos, "while") || word_is(pos, "until")) {
+        node = new_node(word_is(pos, "while") ? NODE_WHILE : NODE_UNTIL);
+        pos += strlen("while"); // "while" and "until" have the same length
+        ok = parse_loop(node);
+    }
+    else if (word_is(pos, "for")) {
+        pos += strlen("for");
+        node = new_node(NODE_FOR);
+        ok = parse_for(node);
+    }
+    else if (word_is(pos, "case")) {
+        pos += strlen("case");
+        node = new_node(NODE_CASE);
+        ok = parse_case(node);
+    }
+    else if (word_in(pos, reserved_words)) {
+        char message[64];
+        snprintf(message, sizeof(message), "unexpected '%.*s'", (int) (word_end(pos, FALSE) - pos), &src[pos]);
+        syntax_error(message);
+        return NULL;
+    }
+    else {
+        return parse_simple();
+    }
+    if (ok) {
+        ok = parse_redirection(node);
+    }
+    if (!ok) {
+        free_script(node);
+        return NULL;
+    }
+    return node;
+}
+
+static struct script_node *parse_list(const char **terminators) {
+    struct script_node *head = NULL;
+    struct script_node **tail = &head;
+    while (parse_status == SCRIPT_OK) {
+        skip_separators();
+        if (!src[pos] || (src[pos] == ';' && src[pos + 1] == ';')) {
+            break;
+        }
+        if (terminators != NULL && word_in(pos, terminators)) {
+            break;
+        }
+        struct script_node *node = parse_command();
+        if (node == NULL) {
+            break;
+        }
+        *tail = node;
+        tail = &node->next;
+    }
+    return head;
+}
+
+struct script_node *parse_script(const char *text, int *status) {
+    src = text;
+    pos = 0;
+    parse_status = SCRIPT_OK;
+    struct script_node *script = parse_list(NULL);
+    if (parse_status == SCRIPT_OK && src[pos]) {
+        // Only a stray ";;" can stop the top level list early
+        syntax_error("unexpected ';;'");
+    }
+    *status = parse_status;
+    if (parse_status != SCRIPT_OK) {
+        free_script(script);
+        return NULL;
+    }
+    return script;
+}
+
+void free_script(struct script_node *node) {
+    while (node != NULL) {
+        struct script_node *next = node->next;
+        free(node->text);
+        free_words(node->words, node->word_count);
+        free(node->word_is_var);
+        free(node->exec_argv);
+        free_script(node->condition);
+        free_script(node->body);
+        free_script(node->else_body);
+        free(node->var_name);
+        free_script(node->word_list);
+        free_script(node->redir_target);
+        struct case_item *item = node->case_items;
+        while (item != NULL) {
+            struct case_item *next_item = item->next;
+            free_script(item->patterns);
+            free_script(item->body);
+            free(item);
+            item = next_item;
+        }
+        free(node);
+        node = next;
+    }
+}
+
+static struct script_node *copy_script_list(struct script_node *node) {
+    struct script_node *head = NULL;
+    struct script_node **tail = &head;
+    while (node != NULL) {
+        *tail = copy_script_node(node);
+        tail = &(*tail)->next;
+        node = node->next;
+    }
+    return head;
+}
+
+struct script_node *copy_script_node(struct script_node *node) {
+    // Deep copies a single node (not the nodes following it)
+    struct script_node *copy = new_node(node->type);
+    if (node->text != NULL) {
+        copy->text = strdup(node->text);
+    }
+    if (node->words != NULL) {
+        // Copy the words instead of splitting the text again
+        copy->word_count = node->word_count;
+        copy->words = (char **) malloc((node->word_count + 1) * sizeof(char *));
+        copy->word_is_var = (char *) malloc((node->word_count + 1) * sizeof(char));
+        copy->exec_argv = (char **) malloc((node->word_count + 1) * sizeof(char *));
+        int k;
+        for (k = 0; k < node->word_count; ++k) {
+            copy->words[k] = strdup(node->words[k]);
+        }
+        memcpy(copy->word_is_var, node->word_is_var, node->word_count * sizeof(char));
+    }
+    copy->condition = copy_script_list(node->condition);
+    copy->body = copy_script_list(node->body);
+    copy->else_body = copy_script_list(node->else_body);
+    if (node->var_name != NULL) {
+        copy->var_name = strdup(node->var_name);
+    }
+    copy->word_list = copy_script_list(node->word_list);
+    copy->redir_mode = node->redir_mode;
+    copy->redir_target = copy_script_list(node->redir_target);
+    struct case_item *item;
+    struct case_item **tail = &copy->case_items;
+    for (item = node->case_items; item != NULL; item = item->next) {
+        *tail = (struct case_item *) calloc(1, sizeof(struct case_item));
+        (*tail)->patterns = copy_script_node(item->patterns);
+        (*tail)->body = copy_script_list(item->body);
+        tail = &(*tail)->next;
+    }
+    return copy;
+}
+
+void free_words(char **words, int count) {
+    if (words == NULL) {
+        return;
+    }
+    while (count > 0) {
+        free(words[--count]);
+    }
+    free(words);
+}
+
+int run_input(char *text) {
+    // Parses and runs text, returning the parse status
+    int status;
+    long long trace_start = TRACING ? trace_now() : 0;
+    struct script_node *script = parse_script(text, &status);
+    if (TRACING) {
+        trace_span("parse", "parse", trace_start, getpid(), text, status);
+    }
+    if (status != SCRIPT_OK) {
+        if (status == SCRIPT_SYNTAX_ERROR) {
+            cmd_error = CMD_ERROR;
+            last_exit_status = 2;
+        }
+        return status;
+    }
+    if (exit_after_input) {
+        // Only for this input, not input run by its commands
+        exit_after_input = FALSE;
+        struct script_node *last = script;
+        while (last != NULL && last->next != NULL) {
+            last = last->next;
+        }
+        if (last != NULL && last->type == NODE_SIMPLE) {
+            tail_node = last;
+        }
+    }
+    cmd_error = CMD_BLANK;
+    trace_start = TRACING ? trace_now() : 0;
+    run_script(script);
+    tail_node = NULL;
+    if (TRACING) {
+        trace_span("execute", "execute", trace_start, getpid(), text, last_exit_status);
+    }
+    free_script(script);
+    return status;
+}
+
+static int fill_exec_argv(struct script_node *node) {
+    // Returns the argument count, or -1 if parse_input() is needed after all
+    int count = 0;
+    int j;
+    for (j = 0; j < node->word_count; ++j) {
+        if (!node->word_is_var[j]) {
+            node->exec_argv[count++] = node->words[j];
+            continue;
+        }
+        const char *value = get_var(node->words[j]);
+        if (value == NULL || value[0] == '\0') {
+            // Unquoted empty expansions disappear
+            continue;
+        }
+        if (strpbrk(value, " \t\n") != NULL) {
+            // Needs field splitting
+            return -1;
+        }
+        node->exec_argv[count++] = (char *) value;
+    }
+    node->exec_argv[count] = NULL;
+    return count;
+}
+
+void run_simple(struct script_node *node) {
+    int count;
+    cmd_exit_status = 0;
+    exec_tail = (node == tail_node);
+    if (node->words != NULL && (count = fill_exec_argv(node)) >= 0) {
+        // Pre-split words: dispatch straight to execute() without parsing
+        if (count == 0) {
+            cmd_error = CMD_BLANK;
+            exec_tail = FALSE;
+            return;
+        }
+        cmd_error = CMD_OKAY;
+        opts = node->exec_argv;
+        optCount = count;
+        opts_borrowed = TRUE;
+        execute();
+        exec_tail = FALSE;
+        opts = NULL;
+        optCount = 0;
+        opts_borrowed = FALSE;
+    }
+    else {
+        parse_input(node->text);
+        free_all();
+        if (cmd_error == CMD_BLANK) {
+            return;
+        }
+    }
+    if (CMD_SUCCEEDED(cmd_error)) {
+        last_exit_status = 0;
+    }
+    else {
+        last_exit_status = cmd_exit_status ? cmd_exit_status : 1;
+    }
+}
+
+char **expand_node_words(struct script_node *node, int *count) {
+    // Expands the words of node into a new array; each word is further
+    // split on newlines (pre-split variables are split on any whitespace)
+    int word_count;
+    char **expanded;
+    const char *separators;
+    if (node->words != NULL) {
+        word_count = node->word_count;
+        expanded = (char **) malloc((word_count + 1) * sizeof(char *));
+        int j;
+        int n = 0;
+        for (j = 0; j < node->word_count; ++j) {
+            const char *value = node->word_is_var[j] ? get_var(node->words[j]) : node->words[j];
+            if (value != NULL) {
+                expanded[n++] = strdup(value);
+            }
+        }
+        word_count = n;
+        separators = " \t\n";
+    }
+    else {
+        expanded = expand_words(node->text, &word_count);
+        separators = "\n";
+    }
+    char **words = (char **) malloc(sizeof(char *));
+    int n = 0;
+    int j;
+    for (j = 0; j < word_count; ++j) {
+        char *saveptr;
+        char *field = strtok_r(expanded[j], separators, &saveptr);
+        while (field != NULL) {
+            words = (char **) realloc(words, (n + 2) * sizeof(char *));
+            words[n++] = strdup(field);
+            field = strtok_r(NULL, separators, &saveptr);
+        }
+    }
+    words[n] = NULL;
+    free_words(expanded, word_count);
+    *count = n;
+    return words;
+}
+
+static void run_if(struct script_node *node) {
+    run_script(node->condition);
+    if (interrupted || break_levels || continue_levels || return_pending) {
+        return;
+    }
+    if (CMD_SUCCEEDED(cmd_error)) {
+        run_script(node->body);
+    }
+    else if (node->else_body != NULL) {
+        run_script(node->else_body);
+    }
+    else {
+        cmd_error = CMD_OKAY;
+        last_exit_status = 0;
+    }
+}
+
+static int end_of_iteration() {
+    // Returns TRUE if the loop has to stop because of break or continue
+    static unsigned int iterations = 0;
+    if (++iterations % SIGNAL_CHECK_INTERVAL == 0) {
+        // SIGINT is only noticed when read from signal_fd, which loops of
+        // builtins never wait on
+        check_signals();
+    }
+    if (break_levels) {
+        --break_levels;
+        return TRUE;
+    }
+    if (continue_levels) {
+        // "continue n" leaves this loop and continues an outer one
+        return --continue_levels > 0;
+    }
+    return interrupted || return_pending;
+}
+
+static void run_loop(struct script_node *node) {
+    char status = CMD_OKAY;
+    int exit_status = 0;
+    ++loop_depth;
+    while (!interrupted) {
+        run_script(node->condition);
+        if (break_levels || continue_levels) {
+            if (end_of_iteration()) {
+                break;
+            }
+            continue;
+        }
+        int condition_met = CMD_SUCCEEDED(cmd_error);
+        if (node->type == NODE_UNTIL) {
+            condition_met = !condition_met;
+        }
+        if (!condition_met) {
+            break;
+        }
+        run_script(node->body);
+        status = cmd_error;
+        exit_status = last_exit_status;
+        if (end_of_iteration()) {
+            break;
+        }
+    }
+    --loop_depth;
+    cmd_error = status;
+    last_exit_status = exit_status;
+}
+
+static void run_for(struct script_node *node) {
+    int count = 0;
+    char **items = NULL;
+    if (node->word_list != NULL) {
+        items = expand_node_words(node->word_list, &count);
+    }
+    else {
+        // "for NAME do" loops over the positional parameters
+        items = copy_positional_params(&count);
+    }
+    cmd_error = CMD_OKAY;
+    last_exit_status = 0;
+    ++loop_depth;
+    int j;
+    for (j = 0; j < count && !interrupted; ++j) {
+        set_var(node->var_name, items[j]);
+        run_script(node->body);
+        if (end_of_iteration()) {
+            break;
+        }
+    }
+    --loop_depth;
+    free_words(items, count);
+}
+
+static void run_case(struct script_node *node) {
+    int count;
+    char **subject = expand_node_words(node->word_list, &count);
+    const char *word = (count > 0) ? subject[0] : "";
+    cmd_error = CMD_OKAY;
+    last_exit_status = 0;
+    struct case_item *item;
+    int matched = FALSE;
+    for (item = node->case_items; item != NULL && !matched; item = item->next) {
+        int pattern_count;
+        char **patterns = expand_node_words(item->patterns, &pattern_count);
+        int j;
+        for (j = 0; j < pattern_count; ++j) {
+            if (fnmatch(patterns[j], word, 0) == 0) {
+                matched = TRUE;
+                break;
+            }
+        }
+        free_words(patterns, pattern_count);
+        if (matched) {
+            run_script(item->body);
+        }
+    }
+    free_words(subject, count);
+}
+
+static int open_redirection(struct script_node *node, int *target_fd) {
+    // Returns the opened file, or -1 on error
+    int count;
+    char **target = expand_node_words(node->redir_target, &count);
+    if (count != 1) {
+        fprintf(stderr, "[Error]: Ambiguous redirect.\n");
+        free_words(target, count);
+        return -1;
+    }
+    int fd;
+    if (node->redir_mode == REDIR_STDIN) {
+        fd = open(target[0], O_RDONLY | O_CLOEXEC);
+        *target_fd = STDIN_FILENO;
+    }
+    else {
+        int mode = (node->redir_mode == REDIR_APPEND_STDOUT) ? O_APPEND : O_TRUNC;
+        fd = open(target[0], O_CREAT | O_WRONLY | O_CLOEXEC | mode, 0644);
+        *target_fd = STDOUT_FILENO;
+    }
+    if (fd < 0) {
+        print_error();
+    }
+    free_words(target, count);
+    return fd;
+}
+
+void run_node(struct script_node *node) {
+    if (node->type == NODE_SIMPLE) {
+        run_simple(node);
+        return;
+    }
+    int fd = NO_FD;
+    int target_fd;
+    int saved_fd;
+    int saved_default;
+    int *default_dup = NULL;
+    // A redirection target or word list may start process substitutions,
+    // which must outlive the commands in the body
+    int first_substitution = process_substitution_count;
+    if (node->redir_mode != REDIR_NONE) {
+        if ((fd = open_redirection(node, &target_fd)) < 0
+            || (saved_fd = fcntl(target_fd, F_DUPFD_CLOEXEC, 0)) < 0
+            || dup2(fd, target_fd) < 0) {
+            if (fd >= 0) {
+                print_error();
+                close(fd);
+            }
+            cmd_error = CMD_ERROR;
+            last_exit_status = 1;
+            return;
+        }
+        // Make the file the stream that parse_input() restores to while
+        // the compound command runs
+        default_dup = (target_fd == STDIN_FILENO) ? &stdin_dup : &stdout_dup;
+        saved_default = *default_dup;
+        *default_dup = fd;
+    }
+    if (node->type == NODE_IF) {
+        run_if(node);
+    }
+    else if (node->type == NODE_WHILE || node->type == NODE_UNTIL) {
+        run_loop(node);
+    }
+    else if (node->type == NODE_FOR) {
+        run_for(node);
+    }
+    else if (node->type == NODE_CASE) {
+        run_case(node);
+    }
+    else if (node->type == NODE_GROUP) {
+        run_script(node->body);
+    }
+    else if (node->type == NODE_FUNCTION_DEF) {
+        define_function(node->var_name, node->body);
+        cmd_error = CMD_OKAY;
+        last_exit_status = 0;
+    }
+    if (default_dup != NULL) {
+        dup2(saved_fd, target_fd);
+        close(saved_fd);
+        close(fd);
+        *default_dup = saved_default;
+    }
+    finish_process_substitutions(first_substitution, TRUE);
+}
+
+void run_script(struct script_node *node) {
+    // Process substitutions started by the commands of this script are
+    // reaped by them, without touching those of the command running it
+    int saved_base = process_substitution_base;
+    process_substitution_base = process_substitution_count;
+    while (node != NULL && !interrupted && !break_levels && !continue_levels && !return_pending) {
+        run_node(node);
+        node = node->next;
+    }
+    finish_process_substitutions(process_substitution_base, TRUE);
+    process_substitution_base = saved_base;
+}
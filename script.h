@@ -0,0 +1,71 @@
+#pragma once
+#include "shell.h"
+#include <fnmatch.h>
+
+// Script node types
+#define NODE_SIMPLE 0
+#define NODE_IF 1
+#define NODE_WHILE 2
+#define NODE_UNTIL 3
+#define NODE_FOR 4
+#define NODE_CASE 5
+#define NODE_GROUP 6
+#define NODE_FUNCTION_DEF 7
+
+// Script parsing results
+#define SCRIPT_OK 0
+#define SCRIPT_INCOMPLETE 1
+#define SCRIPT_SYNTAX_ERROR 2
+
+// Redirections of compound commands (e.g. done < file)
+#define REDIR_NONE 0
+#define REDIR_STDOUT 1
+#define REDIR_APPEND_STDOUT 2
+#define REDIR_STDIN 3
+
+// Loop iterations between checks for a pending SIGINT
+#define SIGNAL_CHECK_INTERVAL 64
+
+struct case_item {
+    struct script_node *patterns;
+    struct script_node *body;
+    struct case_item *next;
+};
+
+// A command parsed once and executed any number of times
+struct script_node {
+    char type;
+    struct script_node *next;
+    // NODE_SIMPLE: the command text, plus its words split ahead of time
+    // when they need no expansion other than whole-word $NAME references
+    char *text;
+    char **words;
+    char *word_is_var;
+    int word_count;
+    char **exec_argv;
+    // Compound commands
+    struct script_node *condition;
+    struct script_node *body;
+    struct script_node *else_body;
+    char *var_name;
+    struct script_node *word_list;
+    struct case_item *case_items;
+    char redir_mode;
+    struct script_node *redir_target;
+};
+
+// Function type signatures
+struct script_node *parse_script(const char *text, int *status);
+void free_script(struct script_node *node);
+struct script_node *copy_script_node(struct script_node *node);
+int run_input(char *text);
+void run_script(struct script_node *node);
+void run_node(struct script_node *node);
+void run_simple(struct script_node *node);
+char **expand_node_words(struct script_node *node, int *count);
+void free_words(char **words, int count);
+
+// Variables
+extern int loop_depth;
+extern int break_levels;
+extern int continue_levels;
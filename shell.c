@@ -1,6 +1,26 @@
 #include "shell.h"
 #include "prompt.h"
 #include "state_stack.h"
+#include "completion.h"
+#include "script.h"
+#include "variables.h"
+#include "functions.h"
+#include "process.h"
+#include "parallel.h"
+#include "trace.h"
+#include "options.h"
+#include "rcfile.h"
+#include "rlimits.h"
+#include "affinity.h"
+#include "batch.h"
+#include "lexer.h"
+#include "onchange.h"
+#include "timeout.h"
+#include "memo.h"
+#include "coproc.h"
+#include "read.h"
+#include "expansion.h"
+#include "stats.h"
 
 char cmd_error = CMD_OKAY;
 int child_pid, rl_child_pid;
@@ -13,36 +33,90 @@ char old_pwd[DIR_NAME_MAX_SIZE];
 char keep_alive = 1;
 char debug_output = 0;
 int cmd_nest_level = 0;
+// '<' or '>' while the command of a process substitution is being collected
+char process_substitution_kind = 0;
 char *cmd_substitution_buffer;
 size_t cmd_substitution_buffer_index = 0;
 int stdin_dup = STDIN_FILENO;
 int stdout_dup = STDOUT_FILENO;
 int stderr_dup = STDERR_FILENO;
 int global_pipes[2] = {NO_FD, NO_FD};
+char opts_borrowed = FALSE;
+char parse_only = FALSE;
+int cmd_exit_status = 0;
+int last_exit_status = 0;
+volatile sig_atomic_t interrupted = FALSE;
+struct last_command last_command = {FALSE, 0, 0, FALSE, 0};
+// Set for -c, scripts and substitutions, which exit once run_input() is done
+char exit_after_input = FALSE;
+// The command being executed is the last one of such input
+char exec_tail = FALSE;
+// Set while executing a pipeline stage whose stdout feeds the next stage
+char in_pipeline = FALSE;
 
-static void sighandler(int signo) {
-    if (signo == CMD_ERROR_SIGNAL) {
-        cmd_error = CMD_ERROR;
+static void readline_sigint_handler() {
+    // Exit gracefully when killed with SIGINT
+    exit(SIGINT_EXIT_CODE);
+}
+
+#ifdef SHIP_NO_READLINE
+char *readline(const char *prompt) {
+    // Stand-in for GNU Readline without line editing, history or completion
+    // Prints the prompt without readline's \001 and \002 markers
+    const char *c;
+    for (c = prompt; *c != '\0'; ++c) {
+        if (*c != '\001' && *c != '\002') {
+            putchar(*c);
+        }
     }
-    else if (signo == SIGINT) {
-        if (child_pid) {
-            kill(child_pid, SIGINT);
+    fflush(stdout);
+    // Reads one byte at a time so that nothing after the line is consumed,
+    // since the next line is read by another process
+    char *line = (char *) malloc(INPUT_BUF_SIZE + 1);
+    size_t length = 0;
+    char byte;
+    ssize_t bytes;
+    while ((bytes = read(STDIN_FILENO, &byte, 1)) > 0 && byte != '\n') {
+        if (length < INPUT_BUF_SIZE) {
+            line[length++] = byte;
         }
-        // If no child process or child process killed
-        if (!child_pid || kill(child_pid, 0) < 0) { // Returns -1 on error
-            if (rl_child_pid) {
-                // Kill readline process to refresh prompt
-                kill(rl_child_pid, SIGINT);
-            }
+    }
+    if (bytes <= 0 && length == 0) {
+        free(line);
+        return NULL;
+    }
+    line[length] = '\0';
+    return line;
+}
+
+#endif
+#ifdef SHIP_STATIC
+static struct passwd *find_passwd_entry(const char *name, uid_t uid) {
+    // Matches by name, or by uid when name is NULL
+    FILE *passwd_file = fopen("/etc/passwd", "re");
+    if (passwd_file == NULL) {
+        return NULL;
+    }
+    struct passwd *entry;
+    while ((entry = fgetpwent(passwd_file)) != NULL) {
+        if (name != NULL ? strcmp(entry->pw_name, name) == 0 : entry->pw_uid == uid) {
+            break;
         }
     }
+    // The entry lives in static storage, so it outlives the file
+    fclose(passwd_file);
+    return entry;
 }
 
-static void readline_sigint_handler() {
-    // Exit gracefully when killed with SIGINT
-    exit(SIGINT_EXIT_CODE);
+struct passwd *static_getpwnam(const char *name) {
+    return find_passwd_entry(name, 0);
 }
 
+struct passwd *static_getpwuid(uid_t uid) {
+    return find_passwd_entry(NULL, uid);
+}
+
+#endif
 void print_error() {
     if (errno) {
         fprintf(stderr, "[Error %d]: %s\n", errno, strerror(errno));
@@ -54,7 +128,7 @@ int save_stdin() {
     if (stdin_dup == STDIN_FILENO) {
         if (debug_output)
             fprintf(stderr, "Updating stdin_dup\n");
-        if ((stdin_dup = dup(STDIN_FILENO)) < 0) {
+        if ((stdin_dup = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0)) < 0) {
             print_error();
             return -1;
         }
@@ -67,7 +141,7 @@ int save_stdout() {
     if (stdout_dup == STDOUT_FILENO) {
         if (debug_output)
             fprintf(stderr, "Updating stdout_dup\n");
-        if ((stdout_dup = dup(STDOUT_FILENO)) < 0) {
+        if ((stdout_dup = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) < 0) {
             print_error();
             return -1;
         }
@@ -80,7 +154,7 @@ int save_stderr() {
     if (stderr_dup == STDERR_FILENO) {
         if (debug_output)
             fprintf(stderr, "Updating stderr_dup\n");
-        if ((stderr_dup = dup(STDERR_FILENO)) < 0) {
+        if ((stderr_dup = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0)) < 0) {
             print_error();
             return -1;
         }
@@ -149,10 +223,141 @@ void cd_back() {
     cd(old_pwd);
 }
 
+void loop_control(const char *cmd, const char *levels_arg) {
+    int levels = (levels_arg != NULL) ? atoi(levels_arg) : 1;
+    if (loop_depth == 0 || levels < 1) {
+        fprintf(stderr, "[Error]: %s: only meaningful in a loop.\n", cmd);
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    // Leaving more loops than exist leaves all of them
+    if (levels > loop_depth) {
+        levels = loop_depth;
+    }
+    if (strcmp(cmd, cmd_break) == 0) {
+        break_levels = levels;
+    }
+    else {
+        continue_levels = levels;
+    }
+}
+
+void export_vars(char **names) {
+    int k;
+    for (k = 0; names[k] != NULL; ++k) {
+        // Accepts both NAME and NAME=VALUE
+        size_t name_length = var_name_length(names[k]);
+        if (name_length == 0 || (names[k][name_length] != '\0' && names[k][name_length] != '=')) {
+            fprintf(stderr, "[Error]: export: invalid name %s\n", names[k]);
+            cmd_error = CMD_ERROR;
+            continue;
+        }
+        try_assignment(names[k]);
+        char name[name_length + 1];
+        strncpy(name, names[k], name_length);
+        name[name_length] = '\0';
+        export_var(name);
+    }
+}
+
+size_t get_builtin_names(const char **names) {
+    // Fills names, which must have room for MAX_BUILTINS, and returns the count
+    const char *builtins[] = {cmd_exit, cmd_cd, cmd_back, cmd_break, cmd_continue, cmd_colon, cmd_true, cmd_false, cmd_export, cmd_unset, cmd_return, cmd_alias, cmd_unalias, cmd_parallel, cmd_shopt, cmd_source, cmd_ulimit, cmd_limit, cmd_pin, cmd_batch, cmd_onchange, cmd_timeout, cmd_memo, cmd_coproc, cmd_read, cmd_shipstat};
+    size_t count = sizeof(builtins) / sizeof(builtins[0]);
+    memcpy(names, builtins, count * sizeof(char *));
+    return count;
+}
+
+int is_builtin(const char *name) {
+    const char *builtins[MAX_BUILTINS];
+    size_t count = get_builtin_names(builtins);
+    size_t k;
+    for (k = 0; k < count; ++k) {
+        if (strcmp(builtins[k], name) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void record_wait_status(int status) {
+    // Sets cmd_exit_status and cmd_error from a waitpid() status
+    last_command.waited = TRUE;
+    last_command.wait_status = status;
+    if (command_timeout.expired) {
+        // Whatever the signal did to the pipeline, it ran out of time
+        fprintf(stderr, "[Error]: %s: timed out\n", opts[0]);
+        cmd_exit_status = TIMEOUT_EXIT_CODE;
+        cmd_error = CMD_TIMED_OUT;
+        return;
+    }
+    if (WIFEXITED(status)) {
+        cmd_exit_status = WEXITSTATUS(status);
+        if (WEXITSTATUS(status)) { // If exit status not 0
+            cmd_error = CMD_ERROR;
+        }
+    }
+    else if (WIFSIGNALED(status)) {
+        cmd_exit_status = 128 + WTERMSIG(status);
+        cmd_error = CMD_ERROR;
+        const char *reason = limit_exceeded_reason(status);
+        if (reason != NULL) {
+            fprintf(stderr, "[Error]: %s: %s\n", opts[0], reason);
+            cmd_error = CMD_LIMIT_EXCEEDED;
+        }
+        // Stop any loop that is running the command
+        if (WTERMSIG(status) == SIGINT) {
+            interrupted = TRUE;
+        }
+    }
+}
+
+int fork_pipeline_stage() {
+    // Gives a builtin that writes a lot of output, or never returns, a
+    // process of its own, so later stages can start and read from it
+    // Returns 0 in the child, the pid in the shell, or -1 if the fork failed
+    COUNT_STAT(STAT_FORKS, 1);
+    int pid = fork();
+    if (pid < 0) {
+        print_error();
+        cmd_error = CMD_ERROR;
+    }
+    else if (!pid) {
+        // The earlier stages are the shell's children, not this one's
+        pipeline_child_count = 0;
+        in_pipeline = FALSE;
+        if (apply_child_placement() < 0) {
+            print_error();
+            exit(1);
+        }
+        clear_child_placement();
+    }
+    else {
+        if (TRACING) {
+            trace_process_start(pid, opts);
+        }
+        if (child_placement.active) {
+            ++child_placement.next_stage;
+        }
+        add_pipeline_child(pid);
+    }
+    return pid;
+}
+
 void execute() {
     if (optCount <= 0) {
         return;
     }
+    // Set again by record_wait_status() if this command is waited for
+    last_command.waited = FALSE;
+    long long trace_start = TRACING ? trace_now() : 0;
+    // Taken now, since source frees opts when it runs its script
+    char trace_name[TRACE_NAME_MAX_SIZE];
+    char trace_detail[TRACE_DETAIL_MAX_SIZE];
+    if (TRACING) {
+        snprintf(trace_name, sizeof(trace_name), "%s", opts[0]);
+        trace_join_argv(opts, trace_detail, sizeof(trace_detail));
+    }
 
     if (debug_output)
         printf("cmd: %s\n", opts[0]);
@@ -166,6 +371,7 @@ void execute() {
         printf("<~~~~~~~~ Output ~~~~~~~~>\n");
 
     // Handle built-in commands
+    struct shell_function *function;
     if (strcmp(opts[0], cmd_exit) == 0) {
         printf("Exiting...\n");
         free_all();
@@ -184,32 +390,282 @@ void execute() {
     else if (strcmp(opts[0], cmd_back) == 0) {
         cd_back();
     }
-    else {
-        // Fork to execute command
-        child_pid = fork();
-        if (!child_pid) {
-            if (execvp(opts[0], opts) < 0) { // Returns -1 if error
+    else if (strcmp(opts[0], cmd_break) == 0 || strcmp(opts[0], cmd_continue) == 0) {
+        loop_control(opts[0], opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_colon) == 0 || strcmp(opts[0], cmd_true) == 0) {
+        // Always succeeds
+    }
+    else if (strcmp(opts[0], cmd_false) == 0) {
+        cmd_error = CMD_ERROR;
+    }
+    else if (strcmp(opts[0], cmd_export) == 0) {
+        export_vars(&opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_unset) == 0) {
+        int k;
+        for (k = 1; k < optCount; ++k) {
+            unset_var(opts[k]);
+        }
+    }
+    else if (strcmp(opts[0], cmd_return) == 0) {
+        return_from_function(opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_alias) == 0) {
+        alias_builtin(&opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_unalias) == 0) {
+        unalias_builtin(&opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_parallel) == 0) {
+        if (!in_pipeline) {
+            parallel_builtin(&opts[1]);
+        }
+        else if (fork_pipeline_stage() == 0) {
+            // Job output is copied to stdout, so it must not fill the pipe
+            // before the next stage is running
+            parallel_builtin(&opts[1]);
+            fflush(stdout);
+            exit(CMD_FAILED(cmd_error) ? (cmd_exit_status ? cmd_exit_status : 1) : 0);
+        }
+    }
+    else if (strcmp(opts[0], cmd_shopt) == 0) {
+        shopt_builtin(&opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_source) == 0) {
+        source_builtin(&opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_ulimit) == 0) {
+        ulimit_builtin(&opts[1]);
+    }
+    else if (strcmp(opts[0], cmd_limit) == 0) {
+        limit_builtin(&opts[1], optCount - 1);
+    }
+    else if (strcmp(opts[0], cmd_pin) == 0) {
+        pin_builtin(&opts[1], optCount - 1);
+    }
+    else if (strcmp(opts[0], cmd_batch) == 0) {
+        batch_builtin(&opts[1], optCount - 1);
+    }
+    else if (strcmp(opts[0], cmd_onchange) == 0) {
+        if (!in_pipeline) {
+            onchange_builtin(&opts[1], optCount - 1);
+        }
+        else if (fork_pipeline_stage() == 0) {
+            // onchange only returns once it is interrupted, so the next stage
+            // would never start
+            onchange_builtin(&opts[1], optCount - 1);
+            fflush(stdout);
+            exit(CMD_FAILED(cmd_error) ? (cmd_exit_status ? cmd_exit_status : 1) : 0);
+        }
+    }
+    else if (strcmp(opts[0], cmd_timeout) == 0) {
+        timeout_builtin(&opts[1], optCount - 1);
+    }
+    else if (strcmp(opts[0], cmd_memo) == 0) {
+        if (!in_pipeline) {
+            memo_builtin(&opts[1], optCount - 1);
+        }
+        else if (fork_pipeline_stage() == 0) {
+            // The output, cached or captured, is written from this process
+            memo_builtin(&opts[1], optCount - 1);
+            fflush(stdout);
+            exit(CMD_FAILED(cmd_error) ? (cmd_exit_status ? cmd_exit_status : 1) : 0);
+        }
+    }
+    else if (strcmp(opts[0], cmd_coproc) == 0) {
+        coproc_builtin(&opts[1], optCount - 1);
+    }
+    else if (strcmp(opts[0], cmd_read) == 0) {
+        read_builtin(&opts[1], optCount - 1);
+    }
+    else if (strcmp(opts[0], cmd_shipstat) == 0) {
+        shipstat_builtin(&opts[1], optCount - 1);
+    }
+    else if (optCount == 1 && try_assignment(opts[0])) {
+        // Variable assignment (NAME=VALUE)
+    }
+    else if ((function = find_function(opts[0])) != NULL) {
+        if (in_pipeline) {
+            // Run the function in a subshell so later stages can read its
+            // output while it runs
+            if (fork_pipeline_stage() == 0) {
+                call_function(function, &opts[1], optCount - 1);
+                fflush(stdout);
+                exit(cmd_exit_status);
+            }
+        }
+        else {
+            call_function(function, &opts[1], optCount - 1);
+        }
+    }
+    else if (should_batch(opts, optCount)) {
+        // Too many arguments for one exec, so run the command several times
+        if (in_pipeline) {
+            // Batches run one after another, so they need a process of their
+            // own to run alongside the other stages
+            COUNT_STAT(STAT_FORKS, 1);
+            int pid = fork();
+            if (pid < 0) {
                 print_error();
-                // Notify parent of error
-                kill(getppid(), CMD_ERROR_SIGNAL);
+                cmd_error = CMD_ERROR;
+            }
+            else if (!pid) {
+                in_pipeline = FALSE;
+                int status = run_batches(opts, optCount);
+                if (status < 0) {
+                    print_error();
+                    exit((errno == ENOENT) ? EXEC_NOT_FOUND_EXIT_CODE : EXEC_FAIL_EXIT_CODE);
+                }
+                exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            }
+            else {
+                add_pipeline_child(pid);
             }
-            // Note: child automatically exits after successful execvp
-            exit(1);
+        }
+        else {
+            int status = run_batches(opts, optCount);
+            release_pipeline_input();
+            wait_for_pipeline(0, NULL);
+            if (status < 0) {
+                // E2BIG here means a single argument is too long
+                cmd_exit_status = (errno == ENOENT) ? EXEC_NOT_FOUND_EXIT_CODE : EXEC_FAIL_EXIT_CODE;
+                print_error();
+                cmd_error = CMD_ERROR;
+            }
+            else {
+                record_wait_status(status);
+            }
+        }
+    }
+    else {
+        int pid;
+        if (exec_tail && !in_pipeline && pipeline_child_count == 0 && process_substitution_count == 0
+            && !command_timeout.active) {
+            // Nothing is left to run, so there is nothing to fork for; only
+            // returns if the exec failed
+            pid = exec_in_place(opts);
+        }
+        else {
+            pid = spawn_command(opts);
+        }
+        if (pid < 0 && errno == E2BIG) {
+            fprintf(stderr, "[Error]: %s: argument list too long (see batch and shopt arg_batch)\n", opts[0]);
+            cmd_exit_status = EXEC_FAIL_EXIT_CODE;
+            cmd_error = CMD_ERROR;
+        }
+        else if (pid < 0) {
+            // errno is the fork or exec error reported by spawn_command()
+            cmd_exit_status = (errno == ENOENT) ? EXEC_NOT_FOUND_EXIT_CODE : EXEC_FAIL_EXIT_CODE;
+            print_error();
+            cmd_error = CMD_ERROR;
+        }
+        else if (in_pipeline) {
+            // Don't wait; the last stage of the pipeline waits for this one
+            add_pipeline_child(pid);
         }
         else {
             int status;
-            waitpid(child_pid, &status, 0);
-            if (WIFEXITED(status)) {
-                if (WEXITSTATUS(status)) { // If exit status not 0
-                    cmd_error = CMD_ERROR;
-                }
+            release_pipeline_input();
+            if (wait_for_pipeline(pid, &status) == 0) {
+                record_wait_status(status);
             }
         }
+        child_pid = 0;
+    }
+    if (!in_pipeline && pipeline_child_count > 0) {
+        // A builtin ended the pipeline, so reap the stages before it
+        release_pipeline_input();
+        wait_for_pipeline(0, NULL);
+    }
+    if (!in_pipeline) {
+        // A pin or timeout prefix lasts until the last stage of its pipeline
+        clear_child_placement();
+        clear_command_timeout();
+    }
+    // Flush builtin output before stdout is restored or the shell forks
+    fflush(stdout);
+    if (TRACING) {
+        trace_span(trace_name, in_pipeline ? "pipeline stage" : "command", trace_start, getpid(), trace_detail,
+                   CMD_SUCCEEDED(cmd_error) ? 0 : (cmd_exit_status ? cmd_exit_status : 1));
     }
     if (debug_output)
         printf("<~~~~ End of Output ~~~~~>\n");
 }
 
+int start_process_substitution(char *text, char kind) {
+    // Runs text with one end of a pipe as its stdout for <(...) or its
+    // stdin for >(...), concurrently with the outer command
+    // Returns the other end, which the outer command inherits
+    int pipes[2];
+    COUNT_STAT(STAT_PIPES, 1);
+    if (pipe(pipes) < 0) {
+        print_error();
+        return -1;
+    }
+    int child_end = (kind == '<') ? pipes[1] : pipes[0];
+    int shell_end = (kind == '<') ? pipes[0] : pipes[1];
+    // Don't let the child repeat buffered output
+    fflush(stdout);
+    COUNT_STAT(STAT_FORKS, 1);
+    int pid = fork();
+    if (pid < 0) {
+        print_error();
+        close(pipes[0]);
+        close(pipes[1]);
+        return -1;
+    }
+    if (!pid) {
+        close(shell_end);
+        // Pipes of other substitutions would otherwise stay open until this
+        // child exits, and the outer pipeline's stages aren't its children
+        finish_process_substitutions(0, FALSE);
+        process_substitution_count = 0;
+        process_substitution_base = 0;
+        pipeline_child_count = 0;
+        in_pipeline = FALSE;
+        // Stop quietly once the outer command stops reading
+        signal(SIGPIPE, SIG_DFL);
+        if (dup2(child_end, (kind == '<') ? STDOUT_FILENO : STDIN_FILENO) < 0) {
+            print_error();
+            exit(CMD_SUBSTITUTION_FAIL_EXIT_CODE);
+        }
+        close(child_end);
+        debug_output = 0;
+        parse_only = FALSE;
+        exit_after_input = TRUE;
+        if (run_input(text) == SCRIPT_INCOMPLETE) {
+            last_exit_status = 2;
+        }
+        free_all();
+        exit(last_exit_status);
+    }
+    close(child_end);
+    if (add_process_substitution(pid, shell_end) < 0) {
+        fprintf(stderr, "[Error]: Too many process substitutions.\n");
+        close(shell_end);
+        kill(pid, SIGTERM);
+        int status;
+        wait_for_children(&pid, &status, 1);
+        return -1;
+    }
+    if (TRACING) {
+        char *argv[] = {text, NULL};
+        trace_process_start(pid, argv);
+    }
+    return shell_end;
+}
+
+void release_pipeline_input() {
+    // Drop the shell's copies of the pipe feeding the last stage, so the
+    // earlier stages see SIGPIPE if the last one exits without reading
+    if (global_pipes[0] != NO_FD) {
+        restore_stdin();
+        close(global_pipes[0]);
+        global_pipes[0] = NO_FD;
+    }
+}
+
 void reset_global_pipes() {
     if (global_pipes[0] != NO_FD) {
         close(global_pipes[0]);
@@ -243,19 +699,93 @@ void reset_execute_variables() {
     cmd_substitution_buffer_index = 0;
     // Reset command nest level
     cmd_nest_level = 0;
+    if (!parse_only) {
+        // The command is done with its process substitutions, but the
+        // earlier stages of a pipeline may still be reading from them
+        finish_process_substitutions(process_substitution_base, pipeline_child_count == 0);
+    }
 }
 
 void free_all() {
     // Free dynamically allocated memory
-    if (optCount > 0) {
+    // Borrowed opts belong to a pre-parsed script node
+    if (!opts_borrowed) {
         while (optCount > 0) {
             free(opts[--optCount]);
         }
+        free(opts);
     }
+    opts = NULL;
+    optCount = 0;
     free(tok);
-    free(opts);
+    tok = NULL;
     free(cmd_substitution_buffer);
+    cmd_substitution_buffer = NULL;
+    reset_global_pipes();
+}
+
+void save_parse_context(struct parse_context *context) {
+    context->opts = opts;
+    context->optCount = optCount;
+    context->tok = tok;
+    context->tokIndex = tokIndex;
+    context->cmd_substitution_buffer = cmd_substitution_buffer;
+    context->cmd_substitution_buffer_index = cmd_substitution_buffer_index;
+    context->cmd_nest_level = cmd_nest_level;
+    context->global_pipes[0] = global_pipes[0];
+    context->global_pipes[1] = global_pipes[1];
+    context->stdin_dup = stdin_dup;
+    context->stdout_dup = stdout_dup;
+    context->stderr_dup = stderr_dup;
+    context->opts_borrowed = opts_borrowed;
+    context->parse_only = parse_only;
+    context->states = save_state_stack(&context->state_count);
+    // Start the nested parse from scratch
+    opts = NULL;
+    optCount = 0;
+    tok = NULL;
+    tokIndex = 0;
+    cmd_substitution_buffer = NULL;
+    cmd_substitution_buffer_index = 0;
+    cmd_nest_level = 0;
+    global_pipes[0] = NO_FD;
+    global_pipes[1] = NO_FD;
+    // Mark the backups stale so the nested parse restores to the current
+    // (possibly redirected) streams instead of the outer defaults
+    stdin_dup = STDIN_FILENO;
+    stdout_dup = STDOUT_FILENO;
+    stderr_dup = STDERR_FILENO;
+    opts_borrowed = FALSE;
+    parse_only = FALSE;
+}
+
+void restore_parse_context(struct parse_context *context) {
+    // Close the backups made by the nested parse
+    if (stdin_dup != STDIN_FILENO) {
+        close(stdin_dup);
+    }
+    if (stdout_dup != STDOUT_FILENO) {
+        close(stdout_dup);
+    }
+    if (stderr_dup != STDERR_FILENO) {
+        close(stderr_dup);
+    }
     reset_global_pipes();
+    opts = context->opts;
+    optCount = context->optCount;
+    tok = context->tok;
+    tokIndex = context->tokIndex;
+    cmd_substitution_buffer = context->cmd_substitution_buffer;
+    cmd_substitution_buffer_index = context->cmd_substitution_buffer_index;
+    cmd_nest_level = context->cmd_nest_level;
+    global_pipes[0] = context->global_pipes[0];
+    global_pipes[1] = context->global_pipes[1];
+    stdin_dup = context->stdin_dup;
+    stdout_dup = context->stdout_dup;
+    stderr_dup = context->stderr_dup;
+    opts_borrowed = context->opts_borrowed;
+    parse_only = context->parse_only;
+    restore_state_stack(context->states, context->state_count);
 }
 
 void parse_input(char input[INPUT_BUF_SIZE]) {
@@ -271,24 +801,31 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
     cmd_nest_level = 0;
     cmd_substitution_buffer = (char *) malloc(CMD_SUBSTITUTION_BUF_SIZE * sizeof(char));
     cmd_substitution_buffer_index = 0;
+    // Only a command with nothing after it in input may replace the shell
+    char input_is_tail = exec_tail;
+    exec_tail = FALSE;
     if (save_default_fds() < 0) {
         return;
     }
 
     inline char *get_next_keyword(const char *extra_delims) {
-        char *keyword = (char *) malloc(sizeof(char));
-        int keyword_index = 0;
-        int index = i;
-        char tmp = input[++index];
-        while (tmp && tmp != '\n' && tmp != ' ' && strchr(extra_delims, tmp) == NULL) {
-            keyword = (char *) realloc(keyword, (keyword_index + 1) * sizeof(char));
-            keyword[keyword_index++] = tmp;
-            tmp = input[++index];
+        // Find the end first, so the keyword is copied in one go
+        int end = i + 1;
+        while (input[end] && input[end] != '\n' && input[end] != ' ' && strchr(extra_delims, input[end]) == NULL) {
+            ++end;
         }
-        // Add null-terminator
-        keyword = (char *) realloc(keyword, (keyword_index + 1) * sizeof(char));
-        keyword[keyword_index] = '\0';
-        return keyword;
+        return strndup(&input[i + 1], end - (i + 1));
+    }
+
+    inline void execute_last_if_tail() {
+        // Executes opts, letting it replace the shell if it is the last
+        // command of the input that this process exits after
+        if (input_is_tail) {
+            size_t rest = (input[i] == '\0') ? i : i + 1;
+            exec_tail = (input[rest + strspn(&input[rest], " \t\n")] == '\0');
+        }
+        execute();
+        exec_tail = FALSE;
     }
 
     inline char *get_escaped(char *s) {
@@ -334,9 +871,8 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
         if (tok[0] != '\0') { // Make sure an argument exists to add
             opts = (char **) realloc(opts, (optCount + 1) * sizeof(char *));
             opts[optCount] = (char *) malloc((strlen(tok) + 1) * sizeof(char));
-            // Copy token to opts and add null terminator
-            strncpy(opts[optCount], tok, strlen(tok));
-            opts[optCount][strlen(tok)] = '\0';
+            // Copy token to opts, including its null terminator
+            memcpy(opts[optCount], tok, strlen(tok) + 1);
             // Increment optCount counter
             ++optCount;
             // Reset tok
@@ -360,8 +896,276 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
         tok[++tokIndex] = '\0';
     }
 
+    inline void copy_plain_run_to_tok() {
+        // Copies the plain characters starting at input[i] with one realloc,
+        // leaving i on the last of them
+        size_t length = lex_scan_plain(&input[i]);
+        tok = (char *) realloc(tok, (tokIndex + length + 1) * sizeof(char));
+        memcpy(&tok[tokIndex], &input[i], length);
+        tokIndex += length;
+        tok[tokIndex] = '\0';
+        i += length - 1;
+    }
+
+    inline void append_expansion_to_tok(const char *value, size_t length, int split_fields) {
+        // Unquoted expansions are split into separate arguments on whitespace
+        if (!split_fields) {
+            tok = (char *) realloc(tok, (tokIndex + length + 1) * sizeof(char));
+            memcpy(&tok[tokIndex], value, length);
+            tokIndex += length;
+            tok[tokIndex] = '\0';
+            return;
+        }
+        size_t k;
+        for (k = 0; k < length; ++k) {
+            if (value[k] == ' ' || value[k] == '\t' || value[k] == '\n') {
+                add_tok_to_opts_array_and_clear_tok();
+            }
+            else {
+                tok = (char *) realloc(tok, (tokIndex + 2) * sizeof(char));
+                tok[tokIndex] = value[k];
+                tok[++tokIndex] = '\0';
+            }
+        }
+    }
+
+    inline void expand_string_operator() {
+        // Handles ${#NAME}, ${NAME:-WORD}, ${NAME:=WORD}, ${NAME#PATTERN},
+        // ${NAME%PATTERN}, ${NAME/PATTERN/WORD} and ${NAME:OFFSET:LENGTH}
+        // Results are slices of the value appended straight to tok; only the
+        // words of the operator are expanded, into buffers on the stack
+        struct parameter_operator op;
+        size_t length = parse_parameter_operator(&input[i + 2], &op);
+        if (length == 0) {
+            fprintf(stderr, "[Error]: Bad substitution.\n");
+            cmd_error = CMD_ERROR;
+            return;
+        }
+        // Advance to the closing }
+        i += length + 1;
+        char word[PARAMETER_WORD_MAX_SIZE];
+        char second[PARAMETER_WORD_MAX_SIZE];
+        size_t word_length = 0;
+        size_t second_length = 0;
+        int pattern = (op.kind == PARAMETER_TRIM_PREFIX || op.kind == PARAMETER_TRIM_SUFFIX || op.kind == PARAMETER_REPLACE);
+        if (op.kind != PARAMETER_LENGTH
+            && ((word_length = expand_parameter_word(op.word, op.word_length, word, sizeof(word), pattern)) == SIZE_MAX
+                || (op.has_second && (second_length = expand_parameter_word(op.second, op.second_length, second, sizeof(second), FALSE)) == SIZE_MAX))) {
+            fprintf(stderr, "[Error]: Bad substitution.\n");
+            cmd_error = CMD_ERROR;
+            return;
+        }
+        // After the words, which may also use special_var_buf
+        const char *value = get_var_n(op.name, op.name_length);
+        int unset = (value == NULL);
+        if (unset) {
+            value = "";
+        }
+        size_t value_length = strlen(value);
+        int split = (get_state() == STATE_NORMAL);
+        size_t start;
+        size_t end;
+        if (op.kind == PARAMETER_LENGTH) {
+            char digits[VAR_SPECIAL_BUF_SIZE];
+            append_expansion_to_tok(digits, snprintf(digits, sizeof(digits), "%zu", value_length), split);
+        }
+        else if (op.kind == PARAMETER_DEFAULT || op.kind == PARAMETER_ASSIGN) {
+            if (!unset && !(op.colon && value_length == 0)) {
+                append_expansion_to_tok(value, value_length, split);
+                return;
+            }
+            if (op.kind == PARAMETER_ASSIGN) {
+                if (var_name_length(op.name) != op.name_length) {
+                    fprintf(stderr, "[Error]: $%.*s: cannot assign in this way\n", (int) op.name_length, op.name);
+                    cmd_error = CMD_ERROR;
+                    return;
+                }
+                char name[op.name_length + 1];
+                memcpy(name, op.name, op.name_length);
+                name[op.name_length] = '\0';
+                set_var_n(name, word, word_length);
+            }
+            append_expansion_to_tok(word, word_length, split);
+        }
+        else if (op.kind == PARAMETER_TRIM_PREFIX || op.kind == PARAMETER_TRIM_SUFFIX) {
+            length = trim_parameter(value, value_length, word, word_length, op.kind == PARAMETER_TRIM_SUFFIX, op.longest, &start);
+            append_expansion_to_tok(&value[start], length, split);
+        }
+        else if (op.kind == PARAMETER_SUBSTRING) {
+            if (substring_bounds(value_length, word, op.has_second ? second : NULL, &start, &end) < 0) {
+                fprintf(stderr, "[Error]: Bad substitution.\n");
+                cmd_error = CMD_ERROR;
+                return;
+            }
+            append_expansion_to_tok(&value[start], end - start, split);
+        }
+        else {
+            // Copies the text between the matches, and the replacement in
+            // place of each one
+            size_t from = 0;
+            while (find_parameter_pattern(value, value_length, from, word, word_length, op.anchor, &start, &end)) {
+                append_expansion_to_tok(&value[from], start - from, split);
+                append_expansion_to_tok(second, second_length, split);
+                from = end;
+                if (!op.all || op.anchor != PARAMETER_ANCHOR_NONE) {
+                    break;
+                }
+            }
+            append_expansion_to_tok(&value[from], value_length - from, split);
+        }
+    }
+
+    inline void expand_variable() {
+        // Handles $NAME, ${NAME}, positional parameters, $?, $$, $#, $@ and $*
+        int braced = (input[i + 1] == '{');
+        char *name = &input[i + 1 + braced];
+        size_t name_length = special_param_length(name, braced);
+        if (name_length == 0) {
+            name_length = var_name_length(name);
+        }
+        if (braced && name[name_length] != '}') {
+            expand_string_operator();
+            return;
+        }
+        // Advance to the last character of the reference
+        i += name_length + 2 * braced;
+        const char *value = get_var_n(name, name_length);
+        if (value != NULL) {
+            append_expansion_to_tok(value, strlen(value), get_state() == STATE_NORMAL);
+        }
+    }
+
+    inline int open_redirection_target(int flags) {
+        // >&N and <&N use a copy of file descriptor N (e.g. a coprocess's)
+        // instead of a file
+        if (tok[0] == '&' && tok[1] != '\0' && strspn(&tok[1], "0123456789") == strlen(&tok[1])) {
+            return fcntl(atoi(&tok[1]), F_DUPFD_CLOEXEC, 0);
+        }
+        return open(tok, flags, 0644);
+    }
+
+    inline void finish_stdout_redirection(int mode) {
+        // Reference tok as file
+        char *file = tok;
+        if (debug_output)
+            printf("Redirect to file: %s\n", file);
+        int fd = open_redirection_target(O_CREAT | O_WRONLY | O_CLOEXEC | mode); // Open file for redirection
+        if (fd < 0) { // fd is -1 on error
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        int l_stdout_dup;
+        if ((l_stdout_dup = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) < 0) {
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        if (dup2(fd, STDOUT_FILENO) < 0) { // Redirect stdout to fd, returns -1 on error
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        add_required_null_for_exec();
+        execute_last_if_tail();
+        close(fd);
+        if (dup2(l_stdout_dup, STDOUT_FILENO) < 0) { // Restore stdout
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        close(l_stdout_dup);
+        reset_execute_variables();
+        // If no error came up during execution, then set the cmd_error flag to CMD_FINISHED
+        if (cmd_error >= 0) {
+            cmd_error = CMD_FINISHED;
+        }
+    }
+
+    inline void finish_stdin_redirection() {
+        // Reference tok as file
+        char *file = tok;
+        if (debug_output)
+            printf("Redirect file to stdin: %s\n", file);
+        int fd = open_redirection_target(O_RDONLY | O_CLOEXEC); // Open file for redirection
+        if (fd < 0) { // fd is -1 on error
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        int stdin_dup;
+        if ((stdin_dup = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0)) < 0) {
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        if (dup2(fd, STDIN_FILENO) < 0) { // Redirect fd to stdin
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        add_required_null_for_exec();
+        if (debug_output) {
+            printf("opt: %s\n", opts[0]);
+            printf("optCount: %d\n", optCount);
+        }
+        execute_last_if_tail();
+        close(fd);
+        if (dup2(stdin_dup, STDIN_FILENO) < 0) { // Restore stdin
+            print_error();
+            cmd_error = CMD_ERROR;
+            reset_execute_variables();
+            return;
+        }
+        close(stdin_dup);
+        reset_execute_variables();
+        // If no error came up during execution, then set the cmd_error flag to CMD_FINISHED
+        if (cmd_error >= 0) {
+            cmd_error = CMD_FINISHED;
+        }
+    }
+
+    inline int redirection_target_ends(char state) {
+        // TRUE if input[i] is the last character of a redirection target
+        const char *delims;
+        if (state == STATE_REDIR_STDOUT_TO_FILE) {
+            delims = TERM_DELIM_STATE_REDIR_STDOUT_TO_FILE;
+        }
+        else if (state == STATE_REDIR_APPEND_STDOUT_TO_FILE) {
+            delims = TERM_DELIM_STATE_REDIR_APPEND_STDOUT_TO_FILE;
+        }
+        else if (state == STATE_REDIR_FILE_TO_STDIN) {
+            delims = TERM_DELIM_STATE_REDIR_FILE_TO_STDIN;
+        }
+        else {
+            return FALSE;
+        }
+        return strchr(delims, input[i+1]) != NULL || input[i+1] == '\0';
+    }
+
+    inline void complete_redirection(char state) {
+        if (pop_state() < 0) {
+            cmd_error = CMD_ERROR;
+            return;
+        }
+        if (state == STATE_REDIR_FILE_TO_STDIN) {
+            finish_stdin_redirection();
+        }
+        else {
+            // If the operator is >>, then append
+            finish_stdout_redirection(state == STATE_REDIR_APPEND_STDOUT_TO_FILE ? O_APPEND : O_TRUNC);
+        }
+    }
+
     // Iterate through each char of input
-    while (input[i] && cmd_error != CMD_ERROR) {
+    while (input[i] && !CMD_FAILED(cmd_error)) {
         char current_state = get_state();
         // Ignore whitespace
         if ((input[i] != '\n' && input[i] != ' ')
@@ -369,17 +1173,27 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                 || current_state == STATE_IN_DOUBLE_QUOTES
                 || current_state == STATE_CMD_SUBSTITUTION)
         ) {
+            // Characters none of the handlers below act on are copied to tok
+            // a run at a time; redirection targets look one character ahead,
+            // so they still go one by one
+            if (!lex_is_special(input[i])
+                && (current_state == STATE_NORMAL
+                    || current_state == STATE_IN_SINGLE_QUOTES
+                    || current_state == STATE_IN_DOUBLE_QUOTES)
+            ) {
+                copy_plain_run_to_tok();
+            }
             // State-specific handlers, persist until terminating delimeter
             // If in command substitution state, keep appending to tok
-            if (current_state == STATE_CMD_SUBSTITUTION
+            else if (current_state == STATE_CMD_SUBSTITUTION
                 && input[i] != '`'
                 && (input[i] != ')'
                     || (input[i] == ')'
                         && cmd_nest_level-- > 0) // Decrement nest level if ')' found
                    )
             ) {
-                // Allow for nested command substitutions using $()
-                if (input[i] == '$' && input[i+1] == '(') {
+                // Allow for nested command and process substitutions
+                if ((input[i] == '$' || input[i] == '<' || input[i] == '>') && input[i+1] == '(') {
                     ++cmd_nest_level; // Increment nest level if "$(" found
                 }
                 if (cmd_substitution_buffer_index < CMD_SUBSTITUTION_BUF_SIZE - 1) {
@@ -429,11 +1243,39 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                         cmd_error = CMD_ERROR;
                         return;
                     }
+                    process_substitution_kind = 0;
                     // Advance past the '(' in "$(", if applicable
                     if (input[i+1] == '(') {
                         ++i;
                     }
                 }
+                // Perform process substitution
+                else if (process_substitution_kind) {
+                    if (pop_state() < 0) {
+                        cmd_error = CMD_ERROR;
+                        return;
+                    }
+                    int fd = start_process_substitution(cmd_substitution_buffer, process_substitution_kind);
+                    process_substitution_kind = 0;
+                    // Reset command substitution buffer
+                    cmd_substitution_buffer[0] = '\0';
+                    cmd_substitution_buffer_index = 0;
+                    cmd_nest_level = 0;
+                    if (fd < 0) {
+                        cmd_error = CMD_ERROR;
+                        return;
+                    }
+                    // The outer command gets the other end of the pipe as a path
+                    char path[PROCESS_SUBSTITUTION_PATH_SIZE];
+                    int path_length = snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+                    tok = (char *) realloc(tok, (tokIndex + path_length + 1) * sizeof(char));
+                    strcpy(&tok[tokIndex], path);
+                    tokIndex += path_length;
+                    // The substitution may have been the whole redirection target
+                    if (redirection_target_ends(get_state())) {
+                        complete_redirection(get_state());
+                    }
+                }
                 // Perform command substitution
                 else {
                     if (pop_state() < 0) {
@@ -450,12 +1292,15 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
 
                     // Pipe from child to parent
                     int pipes[2];
+                    COUNT_STAT(STAT_PIPES, 1);
                     if (pipe(pipes) < 0) { // Returns -1 if error
                         print_error();
                         return;
                     }
 
+                    long long trace_start = TRACING ? trace_now() : 0;
                     // Fork to execute command
+                    COUNT_STAT(STAT_FORKS, 1);
                     int l_child_pid = fork();
                     if (!l_child_pid) {
                         if (dup2(pipes[1], STDOUT_FILENO) < 0) {
@@ -466,24 +1311,51 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                         FILE *dev_null = freopen("/dev/null", "w", stderr); // Redirect stderr to /dev/null
                         // Silence child debug output
                         debug_output = 0;
-                        parse_input(l_input);
+                        // The substitution runs even if only the outer words are being expanded
+                        parse_only = FALSE;
+                        exit_after_input = TRUE;
+                        if (run_input(l_input) == SCRIPT_INCOMPLETE) {
+                            last_exit_status = 2;
+                        }
                         free_all();
                         close(pipes[1]);
                         fclose(dev_null);
-                        exit(cmd_error);
+                        // An exit status, like that of a command exec'd in
+                        // place of this child
+                        exit(last_exit_status);
                     }
                     else {
-                        int status;
-                        waitpid(l_child_pid, &status, 0);
-                        if (WIFEXITED(status)) {
-                            // Set cmd_error flag to exit status of cmd substitution process
-                            cmd_error = WEXITSTATUS(status);
-                        }
                         close(pipes[1]);
-                        char *output = (char *) malloc(MAX_CMD_SUBSTITUTION_SIZE * sizeof(char));
-                        int bytes = read(pipes[0], output, MAX_CMD_SUBSTITUTION_SIZE);
+                        // Read before waiting so a child with a lot of output
+                        // can't fill the pipe and block forever
+                        char *output = (char *) malloc((MAX_CMD_SUBSTITUTION_SIZE + 1) * sizeof(char));
+                        int bytes = 0;
+                        int n;
+                        while (bytes < MAX_CMD_SUBSTITUTION_SIZE
+                               && (n = read(pipes[0], &output[bytes], MAX_CMD_SUBSTITUTION_SIZE - bytes)) != 0) {
+                            if (n < 0) {
+                                if (errno == EINTR) {
+                                    continue;
+                                }
+                                break;
+                            }
+                            bytes += n;
+                        }
+                        // Any output past the limit is dropped with the pipe
+                        close(pipes[0]);
+                        COUNT_STAT(STAT_SUBSTITUTIONS, 1);
+                        COUNT_STAT(STAT_SUBSTITUTION_BYTES, bytes);
+                        // Reported as a failed substitution if the wait fails
+                        int status = W_EXITCODE(CMD_SUBSTITUTION_FAIL_EXIT_CODE, 0);
+                        if (wait_for_children(&l_child_pid, &status, 1) == 0 && WIFEXITED(status)) {
+                            // A failed substitution fails the command using it
+                            cmd_error = WEXITSTATUS(status) ? CMD_ERROR : CMD_OKAY;
+                        }
+                        if (TRACING) {
+                            trace_span("substitution", "substitution", trace_start, l_child_pid, l_input, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+                        }
                         if (bytes == 0) { // Command did not write to stdout
-                            output[0] = '\0';
+                            free(output);
                             return;
                         }
                         output[bytes] = '\0';
@@ -504,9 +1376,8 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                         if (tok[0] != '\0') { // Make sure an argument exists to add
                             opts = (char **) realloc(opts, (optCount + 1) * sizeof(char *));
                             opts[optCount] = (char *) malloc((strlen(tok) + 1) * sizeof(char));
-                            // Copy token to opts and add null-terminator
-                            strncpy(opts[optCount], tok, strlen(tok));
-                            opts[optCount][strlen(tok)] = '\0';
+                            // Copy token to opts, including its null-terminator
+                            memcpy(opts[optCount], tok, strlen(tok) + 1);
                             // Increment optCount counter
                             ++optCount;
                             // Reset tok
@@ -520,12 +1391,27 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                         cmd_substitution_buffer_index = 0;
                         // Reset command nest level
                         cmd_nest_level = 0;
-                        close(pipes[0]);
                         free(output);
-                        wait(NULL);
                     }
                 }
             }
+            // Process substitution with <(...) or >(...)
+            else if ((input[i] == '<' || input[i] == '>')
+                && input[i+1] == '('
+                && (current_state == STATE_NORMAL
+                    || current_state == STATE_REDIR_STDOUT_TO_FILE
+                    || current_state == STATE_REDIR_APPEND_STDOUT_TO_FILE
+                    || current_state == STATE_REDIR_FILE_TO_STDIN)
+            ) {
+                // Collect the command like a command substitution, and run
+                // it when the closing ')' is found
+                if (push_state(STATE_CMD_SUBSTITUTION) < 0) {
+                    cmd_error = CMD_ERROR;
+                    return;
+                }
+                process_substitution_kind = input[i];
+                ++i; // Advance past the '('
+            }
             // Interpret words in single quotes as a single token
             else if (input[i] == '\'') {
                 if (current_state != STATE_IN_SINGLE_QUOTES) {
@@ -556,6 +1442,17 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                     }
                 }
             }
+            // Variable expansion ($NAME, ${NAME}, $1, $?, $$, $#, $@)
+            else if (input[i] == '$'
+                && current_state != STATE_IN_SINGLE_QUOTES
+                && (input[i+1] == '{' || special_param_length(&input[i+1], FALSE) > 0 || var_name_length(&input[i+1]) > 0)
+            ) {
+                expand_variable();
+                // The variable may have been the whole redirection target
+                if (!CMD_FAILED(cmd_error) && redirection_target_ends(current_state)) {
+                    complete_redirection(current_state);
+                }
+            }
             // Tilde (~) expansion
             else if (input[i] == '~') {
                 char *extra_delims = "/;>";
@@ -639,58 +1536,9 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                 }
                 // If currently in redirection state and we've reached the character before the end delimeter
                 else {
-                    int mode;
-                    if (current_state == STATE_REDIR_APPEND_STDOUT_TO_FILE) { // If the operator is >>, then append
-                        mode = O_APPEND;
-                    }
-                    else {
-                        mode = O_TRUNC;
-                    }
-                    if (pop_state() < 0) {
-                        cmd_error = CMD_ERROR;
-                        return;
-                    }
                     // Copy current char to tok to complete filename
                     copy_current_char_to_tok();
-                    // Reference tok as file
-                    char *file = tok;
-                    if (debug_output)
-                        printf("Redirect to file: %s\n", file);
-                    int fd = open(file, O_CREAT | O_WRONLY | mode, 0644); // Open file for redirection
-                    if (fd < 0) { // fd is -1 on error
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    int l_stdout_dup;
-                    if ((l_stdout_dup = dup(STDOUT_FILENO)) < 0) {
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    if (dup2(fd, STDOUT_FILENO) < 0) { // Redirect stdout to fd, returns -1 on error
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    add_required_null_for_exec();
-                    execute();
-                    close(fd);
-                    if (dup2(l_stdout_dup, STDOUT_FILENO) < 0) { // Restore stdout
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    close(l_stdout_dup);
-                    reset_execute_variables();
-                    // If no error came up during execution, then set the cmd_error flag to CMD_FINISHED
-                    if (cmd_error >= 0) {
-                        cmd_error = CMD_FINISHED;
-                    }
+                    complete_redirection(current_state);
                 }
             }
             // Redirection from file to stdin (<)
@@ -718,55 +1566,9 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                 }
                 // If currently in redirection state and we've reached the character before the end delimeter
                 else {
-                    if (pop_state() < 0) {
-                        cmd_error = CMD_ERROR;
-                        return;
-                    }
                     // Copy current char to tok to complete filename
                     copy_current_char_to_tok();
-                    // Reference tok as file
-                    char *file = tok;
-                    if (debug_output)
-                        printf("Redirect file to stdin: %s\n", file);
-                    int fd = open(file, O_RDONLY); // Open file for redirection
-                    if (fd < 0) { // fd is -1 on error
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    int stdin_dup;
-                    if ((stdin_dup = dup(STDIN_FILENO)) < 0) {
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    if (dup2(fd, STDIN_FILENO) < 0) { // Redirect fd to stdin
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    add_required_null_for_exec();
-                    if (debug_output) {
-                        printf("opt: %s\n", opts[0]);
-                        printf("optCount: %d\n", optCount);
-                    }
-                    execute();
-                    close(fd);
-                    if (dup2(stdin_dup, STDIN_FILENO)) { // Restore stdin
-                        print_error();
-                        cmd_error = CMD_ERROR;
-                        reset_execute_variables();
-                        return;
-                    }
-                    close(stdin_dup);
-                    reset_execute_variables();
-                    // If no error came up during execution, then set the cmd_error flag to CMD_FINISHED
-                    if (cmd_error >= 0) {
-                        cmd_error = CMD_FINISHED;
-                    }
+                    complete_redirection(current_state);
                 }
             }
             else if (input[i] == '|') {
@@ -784,20 +1586,49 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
                             return;
                         }
                     }
+                    long pipe_size = get_option(OPT_PIPE_SIZE);
+                    if (input[i + 1] == '{') {
+                        // |{SIZE} sets the capacity of this pipe
+                        char *size_end = strchr(&input[i + 2], '}');
+                        if (size_end == NULL) {
+                            fprintf(stderr, "[Error]: Invalid pipe size.\n");
+                            cmd_error = CMD_ERROR;
+                            return;
+                        }
+                        *size_end = '\0';
+                        int valid = parse_size(&input[i + 2], &pipe_size) == 0;
+                        *size_end = '}';
+                        if (!valid) {
+                            fprintf(stderr, "[Error]: Invalid pipe size.\n");
+                            cmd_error = CMD_ERROR;
+                            return;
+                        }
+                        i = size_end - input;
+                    }
                     add_required_null_for_exec();
                     if (save_default_fds() < 0) {
                         return;
                     }
                     reset_global_pipes();
-                    if (pipe(global_pipes) < 0) { // Returns -1 if error
+                    // Close-on-exec, so no stage holds on to the other end
+                    COUNT_STAT(STAT_PIPES, 1);
+                    if (pipe2(global_pipes, O_CLOEXEC) < 0) { // Returns -1 if error
                         print_error();
                         return;
                     }
+                    if (pipe_size > 0) {
+                        set_pipe_size(global_pipes[1], pipe_size);
+                    }
                     if (dup2(global_pipes[1], STDOUT_FILENO) < 0) {
                         print_error();
                         return;
                     }
+                    in_pipeline = TRUE;
                     execute();
+                    in_pipeline = FALSE;
+                    // Like other shells, only the last stage decides the
+                    // status of the pipeline
+                    cmd_error = CMD_OKAY;
                     reset_execute_variables();
                     if (restore_stdout() < 0) {
                         return;
@@ -819,8 +1650,7 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
             opts = (char **) realloc(opts, (optCount + 1) * sizeof(char *));
             // Copy token to opts array
             opts[optCount] = (char *) malloc((strlen(tok) + 1) * sizeof(char));
-            strncpy(opts[optCount], tok, strlen(tok));
-            opts[optCount][strlen(tok)] = '\0';
+            memcpy(opts[optCount], tok, strlen(tok) + 1);
             // Reset tok
             tok[0] = '\0';
             // Reset tokIndex to 0
@@ -830,11 +1660,18 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
         }
         ++i;
     }
+    if (parse_only) {
+        // Leave the expanded words in opts for expand_words()
+        add_tok_to_opts_array_and_clear_tok();
+        add_required_null_for_exec();
+        restore_default_fds();
+        return;
+    }
     // If a command was supplied, then try to execute it
     // !(optCount == 0 && tokIndex == 0) ensures that there was
     // at least one non-whitespace character in the input.
     // In addition, the input must be valid up to this point
-    if (i >= 1 && !(optCount == 0 && tokIndex == 0) && cmd_error != CMD_ERROR) {
+    if (i >= 1 && !(optCount == 0 && tokIndex == 0) && !CMD_FAILED(cmd_error)) {
         if (debug_output) {
             printf("Executing standalone command\n");
         }
@@ -842,16 +1679,34 @@ void parse_input(char input[INPUT_BUF_SIZE]) {
 
         add_required_null_for_exec();
 
-        execute();
+        execute_last_if_tail();
     }
     else {
         if (cmd_error == CMD_OKAY) {
             cmd_error = CMD_BLANK;
         }
     }
+    // In case an error ended the input in the middle of a pinned pipeline
+    clear_child_placement();
     if (restore_default_fds() < 0) {
         return;
     }
+    finish_process_substitutions(process_substitution_base, TRUE);
+}
+
+char **expand_words(char *text, int *count) {
+    // Expands text like a command line without executing it
+    char saved_cmd_error = cmd_error;
+    parse_only = TRUE;
+    parse_input(text);
+    parse_only = FALSE;
+    char **words = opts;
+    *count = optCount;
+    opts = NULL;
+    optCount = 0;
+    free_all();
+    cmd_error = saved_cmd_error;
+    return words;
 }
 
 /*
@@ -891,24 +1746,123 @@ void get_stdout_execute(char *container, size_t container_size) {
 }
 */
 
-int main() {
-    signal(CMD_ERROR_SIGNAL, sighandler);
-    signal(SIGINT, sighandler);
+void report_startup_phase(const char *phase, long long *phase_start) {
+    // Prints the time since *phase_start and starts the next phase
+    long long now = trace_now();
+    fprintf(stderr, "[startup] %-18s %8lld us\n", phase, now - *phase_start);
+    *phase_start = now;
+}
+
+int main(int argc, char *argv[]) {
+    long long startup_start = trace_now();
+    long long phase_start = startup_start;
+    char startup_profile = FALSE;
+    char *command = NULL;
+    char *script_path = NULL;
+    int k;
+    for (k = 1; k < argc && script_path == NULL; ++k) {
+        if (strcmp(argv[k], "--startup-profile") == 0) {
+            startup_profile = TRUE;
+        }
+        else if (strcmp(argv[k], "-c") == 0 && k + 1 < argc) {
+            command = argv[++k];
+        }
+        else if (argv[k][0] != '-' && command == NULL) {
+            // The rest of the arguments are the script's $1, $2, ...
+            script_path = argv[k];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--startup-profile] [-c command | script [args...]]\n", argv[0]);
+            exit(2);
+        }
+    }
+    init_stats();
+    init_event_loop();
+    init_trace();
+    init_lexer();
     // TODO allow for possible changing home dir
     home = getenv("HOME");
     // Initialize old_pwd to the current directory
     getcwd(old_pwd, sizeof(old_pwd));
+    init_completion();
+    init_variables();
+    init_functions();
+    if (startup_profile)
+        report_startup_phase("init", &phase_start);
+    if (command != NULL || script_path != NULL) {
+        // Like other shells, -c and scripts skip the rc file
+        char *text = command;
+        if (script_path != NULL) {
+            size_t length;
+            if ((text = read_file(script_path, &length)) == NULL) {
+                fprintf(stderr, "[Error]: %s: %s\n", script_path, strerror(errno));
+                exit(EXEC_NOT_FOUND_EXIT_CODE);
+            }
+            set_positional_params(&argv[k], argc - k);
+        }
+        // The last command can replace the shell, unless the startup profile
+        // still has to be printed after it
+        exit_after_input = !startup_profile;
+        if (run_input(text) == SCRIPT_INCOMPLETE && script_path != NULL) {
+            fprintf(stderr, "[Error]: %s: Unexpected end of file.\n", script_path);
+            last_exit_status = 2;
+        }
+        if (startup_profile) {
+            report_startup_phase("command", &phase_start);
+            fprintf(stderr, "[startup] %-18s %8lld us\n", "total", trace_now() - startup_start);
+        }
+        exit(last_exit_status);
+    }
+    int rc_result = source_rc_file();
+    if (startup_profile) {
+        report_startup_phase(rc_result == SOURCE_CACHED ? "rc file (cached)" : "rc file", &phase_start);
+    }
+    init_record();
+    // Lines of an unfinished control statement, waiting for the rest
+    char *pending_input = NULL;
+    // The readline process hands the directory listings it read for
+    // completion back through this, so they outlive the line
+    int listing_fd = NO_FD;
+#ifndef SHIP_NO_READLINE
+    listing_fd = memfd_create("ship-dir-listings", MFD_CLOEXEC);
+#endif
     while (keep_alive) {
+#ifndef SHIP_NO_READLINE
+        // Update the command completion index before the readline process
+        // inherits it
+        refresh_command_index();
+#endif
+        if (startup_profile) {
+            report_startup_phase("command index", &phase_start);
+            fprintf(stderr, "[startup] %-18s %8lld us\n", "total", trace_now() - startup_start);
+            startup_profile = FALSE;
+        }
         int pipes[2]; // Pipe input from child to parent process
+        COUNT_STAT(STAT_PIPES, 1);
         if (pipe(pipes) < 0) { // Returns -1 if error
             print_error();
             exit(1);
         }
+        COUNT_STAT(STAT_FORKS, 1);
         rl_child_pid = fork(); // Fork to read input
         if (!rl_child_pid) {
+            reset_child_signals();
             signal(SIGINT, readline_sigint_handler);
             char *prompt = (char *) malloc(PROMPT_MAX_SIZE * sizeof(char));
-            get_prompt(prompt, PROMPT_MAX_SIZE);
+            long long trace_start = TRACING ? trace_now() : 0;
+            long long prompt_start = monotonic_ns();
+            if (pending_input != NULL) {
+                get_continuation_prompt(prompt, PROMPT_MAX_SIZE);
+            }
+            else {
+                get_prompt(prompt, PROMPT_MAX_SIZE);
+            }
+            // Counted from the readline process through the shared counters
+            COUNT_STAT(STAT_PROMPTS, 1);
+            COUNT_STAT(STAT_PROMPT_NS, monotonic_ns() - prompt_start);
+            if (TRACING) {
+                trace_span("prompt", "prompt", trace_start, getpid(), NULL, 0);
+            }
             close(pipes[0]);
             char *line = readline(prompt);
             if (line == NULL) {
@@ -922,6 +1876,9 @@ int main() {
             }
             size_t write_size = (INPUT_BUF_SIZE > strlen(line)) ? strlen(line) : INPUT_BUF_SIZE;
             write(pipes[1], line, write_size);
+            if (listing_fd >= 0) {
+                save_dir_listings(listing_fd);
+            }
             // Free dynamically allocated memory before exiting
             free(prompt);
             free(line);
@@ -930,7 +1887,13 @@ int main() {
         }
         else {
             int status;
-            waitpid(rl_child_pid, &status, 0);
+            if (wait_for_children(&rl_child_pid, &status, 1) < 0) {
+                exit(1);
+            }
+            rl_child_pid = 0;
+            if (listing_fd >= 0) {
+                load_dir_listings(listing_fd);
+            }
             if (WIFEXITED(status)) {
                 status = WEXITSTATUS(status);
                 if (status == EOF_EXIT_CODE) {
@@ -943,6 +1906,9 @@ int main() {
                     // Close pipe before relooping
                     close(pipes[0]);
                     close(pipes[1]);
+                    // Discard any unfinished control statement
+                    free(pending_input);
+                    pending_input = NULL;
                     // Go to new line before relooping
                     write(STDOUT_FILENO, "\n", 1);
                     continue;
@@ -955,7 +1921,29 @@ int main() {
             input[bytes] = '\0';
             if (debug_output)
                 printf("input: %s\n", input);
-            parse_input(input);
+            record_input(input);
+            interrupted = FALSE;
+            char *script_text = input;
+            if (pending_input != NULL) {
+                pending_input = (char *) realloc(pending_input, (strlen(pending_input) + strlen(input) + 2) * sizeof(char));
+                strcat(pending_input, "\n");
+                strcat(pending_input, input);
+                script_text = pending_input;
+            }
+            last_command.start = monotonic_ns();
+            int result = run_input(script_text);
+            last_command.end = monotonic_ns();
+            if (result == SCRIPT_INCOMPLETE) {
+                // Keep reading lines until the control statement is complete
+                if (pending_input == NULL) {
+                    pending_input = strdup(input);
+                }
+                add_history(input);
+                continue;
+            }
+            last_command.ran = TRUE;
+            free(pending_input);
+            pending_input = NULL;
             // Add command to history if it was successful
             if (cmd_error >= 0) {
                 add_history(input);
@@ -964,8 +1952,6 @@ int main() {
                 if (debug_output)
                     printf("Could not add to history: %d\n", cmd_error);
             }
-            free_all();
-            wait(NULL);
         }
     }
     return 0;
@@ -1,4 +1,6 @@
 #pragma once
+// Needed for pipe2, F_DUPFD_CLOEXEC and other Linux interfaces
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -11,8 +13,26 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <signal.h>
+// Build-time feature switches (see PROFILE in the Makefile):
+// SHIP_NO_READLINE reads plain lines instead of using GNU Readline,
+// SHIP_NO_GIT_PROMPT drops the git segment from the prompt, and
+// SHIP_NO_COLOR drops the colors from the prompt
+#ifndef SHIP_NO_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
+#else
+char *readline(const char *prompt);
+#define add_history(line) ((void) 0)
+#define clear_history() ((void) 0)
+#endif
+// NSS modules can't be loaded into a statically linked binary, so static
+// builds look users up in /etc/passwd directly
+#ifdef SHIP_STATIC
+struct passwd *static_getpwnam(const char *name);
+struct passwd *static_getpwuid(uid_t uid);
+#define getpwnam(name) static_getpwnam(name)
+#define getpwuid(uid) static_getpwuid(uid)
+#endif
 
 // Constants
 #define INPUT_BUF_SIZE 1024
@@ -22,22 +42,53 @@
 // positive or zero cmd_error means successful execution
 #define CMD_ERROR -1
 #define CMD_BLANK -2
+// A resource limit set with ulimit or limit stopped the command
+#define CMD_LIMIT_EXCEEDED -3
+// A timeout prefix stopped the command
+#define CMD_TIMED_OUT -4
 #define CMD_OKAY 0
 #define CMD_FINISHED 1
-#define CMD_ERROR_SIGNAL SIGUSR1
+#define CMD_SUCCEEDED(e) ((e) >= 0 || (e) == CMD_BLANK)
+// Failures that stop the rest of the input
+#define CMD_FAILED(e) ((e) == CMD_ERROR || (e) < CMD_BLANK)
 #define EOF_EXIT_CODE 10
 #define SIGINT_EXIT_CODE 11
 #define CMD_SUBSTITUTION_FAIL_EXIT_CODE 12
 #define PIPE_FAIL_EXIT_CODE 13
 #define MAX_CMD_SUBSTITUTION_SIZE 1024
 #define CMD_SUBSTITUTION_BUF_SIZE 512
+#define PROCESS_SUBSTITUTION_PATH_SIZE 32
 #define PIPE_TARGET_BUF_SIZE 512
 #define NO_FD -1
+#define MAX_BUILTINS 64
 
 // Shell built-in functions
 static const char *cmd_exit = "exit";
 static const char *cmd_cd = "cd";
 static const char *cmd_back = "back";
+static const char *cmd_break = "break";
+static const char *cmd_continue = "continue";
+static const char *cmd_colon = ":";
+static const char *cmd_true = "true";
+static const char *cmd_false = "false";
+static const char *cmd_export = "export";
+static const char *cmd_unset = "unset";
+static const char *cmd_return = "return";
+static const char *cmd_alias = "alias";
+static const char *cmd_unalias = "unalias";
+static const char *cmd_parallel = "parallel";
+static const char *cmd_shopt = "shopt";
+static const char *cmd_source = "source";
+static const char *cmd_ulimit = "ulimit";
+static const char *cmd_limit = "limit";
+static const char *cmd_pin = "pin";
+static const char *cmd_batch = "batch";
+static const char *cmd_onchange = "onchange";
+static const char *cmd_timeout = "timeout";
+static const char *cmd_memo = "memo";
+static const char *cmd_coproc = "coproc";
+static const char *cmd_read = "read";
+static const char *cmd_shipstat = "shipstat";
 
 // Parsing states
 static const char STATE_NORMAL = 0;
@@ -53,8 +104,36 @@ static const char *TERM_DELIM_STATE_REDIR_STDOUT_TO_FILE = " ;<|>\n";
 static const char *TERM_DELIM_STATE_REDIR_APPEND_STDOUT_TO_FILE = " ;<|>\n";
 static const char *TERM_DELIM_STATE_REDIR_FILE_TO_STDIN = " ;<|>\n";
 
+// Parser globals saved while a function body runs in the middle of a parse
+struct parse_context {
+    char **opts;
+    int optCount;
+    char *tok;
+    int tokIndex;
+    char *cmd_substitution_buffer;
+    size_t cmd_substitution_buffer_index;
+    int cmd_nest_level;
+    int global_pipes[2];
+    int stdin_dup, stdout_dup, stderr_dup;
+    char opts_borrowed;
+    char parse_only;
+    char *states;
+    int state_count;
+};
+
+// The last line run from the prompt, for the prompt's status segment
+struct last_command {
+    char ran;
+    // Monotonic nanoseconds
+    long long start;
+    long long end;
+    // The waitpid() status of the last command, if it was a child process;
+    // builtins only leave last_exit_status
+    char waited;
+    int wait_status;
+};
+
 // Function type signatures
-static void sighandler(int signo);
 static void readline_sigint_handler();
 void print_error();
 int save_stdin();
@@ -65,14 +144,24 @@ int restore_stdin();
 int restore_stdout();
 int restore_stderr();
 int restore_default_fds();
+size_t get_builtin_names(const char **names);
+int is_builtin(const char *name);
+void record_wait_status(int status);
+int fork_pipeline_stage();
 void cd(const char *target);
 void cd_back();
 void execute();
+int start_process_substitution(char *text, char kind);
+void release_pipeline_input();
 void reset_global_pipes();
 void reset_execute_variables();
 void free_all();
+void save_parse_context(struct parse_context *context);
+void restore_parse_context(struct parse_context *context);
 void parse_input(char input[INPUT_BUF_SIZE]);
+char **expand_words(char *text, int *count);
 void get_stdout_execute(char *container, size_t container_size);
+void report_startup_phase(const char *phase, long long *phase_start);
 
 // Variables
 extern char cmd_error;
@@ -86,7 +175,17 @@ extern char old_pwd[DIR_NAME_MAX_SIZE];
 extern char keep_alive;
 extern char debug_output;
 extern int cmd_nest_level;
+extern char process_substitution_kind;
 extern char *cmd_substitution_buffer;
 extern size_t cmd_substitution_buffer_index;
 extern int global_pipes[2];
+extern int stdin_dup, stdout_dup, stderr_dup;
+extern char opts_borrowed;
+extern char parse_only;
+extern char in_pipeline;
+extern int cmd_exit_status, last_exit_status;
+extern volatile sig_atomic_t interrupted;
+extern struct last_command last_command;
+extern char exit_after_input;
+extern char exec_tail;
 
@@ -33,3 +33,17 @@ void clear_state_stack() {
     state_stack[stack_pointer++] = STATE_NORMAL;
 }
 
+char *save_state_stack(int *count) {
+    // Returns a copy of the stack so that a nested parse can use it
+    char *saved = (char *) malloc((stack_pointer + 1) * sizeof(char));
+    memcpy(saved, state_stack, stack_pointer * sizeof(char));
+    *count = stack_pointer;
+    return saved;
+}
+
+void restore_state_stack(char *saved, int count) {
+    // Restores and frees a copy made by save_state_stack()
+    memcpy(state_stack, saved, count * sizeof(char));
+    stack_pointer = count;
+    free(saved);
+}
@@ -7,3 +7,5 @@ int push_state(const char state);
 const char pop_state();
 const char get_state();
 void clear_state_stack();
+char *save_state_stack(int *count);
+void restore_state_stack(char *saved, int count);
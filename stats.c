@@ -0,0 +1,152 @@
+#include "stats.h"
+#include <sys/mman.h>
+
+// Counts in this process until init_stats() moves them to the shared mapping;
+// malloc() counts from before main()
+static struct ship_stats startup_stats;
+struct ship_stats *ship_stats = &startup_stats;
+static int stats_pid = 0;
+static const char *stats_file = NULL;
+
+static const char *stat_names[STAT_COUNT] = {
+    "forks",
+    "execs",
+    "pipes",
+    "substitutions",
+    "substitution_bytes",
+    "allocations",
+    "allocated_bytes",
+    "prompts",
+    "prompt_ns",
+    "git_forks",
+    "hash_lookups",
+    "hash_hits",
+    "memo_lookups",
+    "memo_hits",
+    "completion_lookups",
+    "completion_hits",
+};
+
+// Ratios worth reading at a glance, as counter / counter
+static const struct {
+    const char *name;
+    int numerator;
+    int denominator;
+    double scale;
+} stat_ratios[] = {
+    {"prompt_avg_ms", STAT_PROMPT_NS, STAT_PROMPTS, 1e-6},
+    {"hash_hit_rate", STAT_HASH_HITS, STAT_HASH_LOOKUPS, 1},
+    {"memo_hit_rate", STAT_MEMO_HITS, STAT_MEMO_LOOKUPS, 1},
+    {"completion_hit_rate", STAT_COMPLETION_HITS, STAT_COMPLETION_LOOKUPS, 1},
+};
+
+#if !defined(__SANITIZE_ADDRESS__) && !defined(SHIP_STATIC)
+// Counts every allocation, including readline's, on top of glibc's malloc
+// Sanitizers and static builds bring their own malloc, so they go without
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) {
+    COUNT_STAT(STAT_ALLOCATIONS, 1);
+    COUNT_STAT(STAT_ALLOCATED_BYTES, size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    COUNT_STAT(STAT_ALLOCATIONS, 1);
+    COUNT_STAT(STAT_ALLOCATED_BYTES, count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    COUNT_STAT(STAT_ALLOCATIONS, 1);
+    COUNT_STAT(STAT_ALLOCATED_BYTES, size);
+    return __libc_realloc(pointer, size);
+}
+#endif
+
+void init_stats() {
+    // Moves the counters to memory shared with every child forked from here
+    struct ship_stats *shared = (struct ship_stats *) mmap(NULL, sizeof(struct ship_stats), PROT_READ | PROT_WRITE,
+                                                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared != MAP_FAILED) {
+        *shared = startup_stats;
+        ship_stats = shared;
+    }
+    stats_pid = getpid();
+    stats_file = getenv(STATS_ENV_VAR);
+    if (stats_file != NULL && stats_file[0] != '\0') {
+        atexit(dump_stats);
+    }
+}
+
+void print_stats(FILE *stream, char json) {
+    struct ship_stats stats;
+    int k;
+    for (k = 0; k < STAT_COUNT; ++k) {
+        stats.values[k] = __atomic_load_n(&ship_stats->values[k], __ATOMIC_RELAXED);
+    }
+    if (json) {
+        fprintf(stream, "{\"pid\": %d", stats_pid);
+    }
+    else {
+        fprintf(stream, "%-22s %d\n", "pid", stats_pid);
+    }
+    for (k = 0; k < STAT_COUNT; ++k) {
+        fprintf(stream, json ? ", \"%s\": %llu" : "%-22s %llu\n", stat_names[k], stats.values[k]);
+    }
+    for (k = 0; k < (int) (sizeof(stat_ratios) / sizeof(stat_ratios[0])); ++k) {
+        unsigned long long denominator = stats.values[stat_ratios[k].denominator];
+        double ratio = denominator ? stats.values[stat_ratios[k].numerator] * stat_ratios[k].scale / denominator : 0;
+        fprintf(stream, json ? ", \"%s\": %.4f" : "%-22s %.4f\n", stat_ratios[k].name, ratio);
+    }
+    if (json) {
+        fprintf(stream, "}\n");
+    }
+}
+
+void dump_stats() {
+    // Registered with atexit(), which children that exit() also run, and
+    // called before the shell execs its last command
+    if (getpid() != stats_pid || stats_file == NULL || stats_file[0] == '\0') {
+        return;
+    }
+    FILE *stream = (strcmp(stats_file, "-") == 0) ? stderr : fopen(stats_file, "a");
+    if (stream != NULL) {
+        print_stats(stream, TRUE);
+        if (stream != stderr) {
+            fclose(stream);
+        }
+    }
+    // Only once, even if that exec fails and the shell then exits
+    stats_pid = 0;
+}
+
+void shipstat_builtin(char **args, int count) {
+    // shipstat [--json] [--reset]
+    char json = FALSE;
+    char reset = FALSE;
+    int k;
+    for (k = 0; k < count; ++k) {
+        if (strcmp(args[k], "--json") == 0 || strcmp(args[k], "-j") == 0) {
+            json = TRUE;
+        }
+        else if (strcmp(args[k], "--reset") == 0) {
+            reset = TRUE;
+        }
+        else {
+            fprintf(stderr, "[Error]: shipstat: usage: shipstat [--json] [--reset]\n");
+            cmd_exit_status = 2;
+            cmd_error = CMD_ERROR;
+            return;
+        }
+    }
+    if (reset) {
+        for (k = 0; k < STAT_COUNT; ++k) {
+            __atomic_store_n(&ship_stats->values[k], 0, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    print_stats(stdout, json);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "shell.h"
+
+// Constants
+// Writes the counters as JSON to this file (or stderr for -) when the shell
+// exits
+#define STATS_ENV_VAR "SHIP_STATS"
+
+// Counters, indices into ship_stats->values
+#define STAT_FORKS 0
+#define STAT_EXECS 1
+#define STAT_PIPES 2
+#define STAT_SUBSTITUTIONS 3
+#define STAT_SUBSTITUTION_BYTES 4
+#define STAT_ALLOCATIONS 5
+#define STAT_ALLOCATED_BYTES 6
+#define STAT_PROMPTS 7
+#define STAT_PROMPT_NS 8
+#define STAT_GIT_FORKS 9
+#define STAT_HASH_LOOKUPS 10
+#define STAT_HASH_HITS 11
+#define STAT_MEMO_LOOKUPS 12
+#define STAT_MEMO_HITS 13
+#define STAT_COMPLETION_LOOKUPS 14
+#define STAT_COMPLETION_HITS 15
+#define STAT_COUNT 16
+
+// Lives in a shared mapping so that counts from forked children (the
+// readline process, subshells, children about to exec) reach the shell
+struct ship_stats {
+    unsigned long long values[STAT_COUNT];
+};
+
+// Cheap enough to leave on everywhere: one relaxed atomic add
+#define COUNT_STAT(counter, n) __atomic_fetch_add(&ship_stats->values[(counter)], (n), __ATOMIC_RELAXED)
+
+// Function type signatures
+void init_stats();
+void shipstat_builtin(char **args, int count);
+void print_stats(FILE *stream, char json);
+void dump_stats();
+
+// Variables
+extern struct ship_stats *ship_stats;
@@ -0,0 +1,178 @@
+#include "timeout.h"
+#include "functions.h"
+
+struct command_timeout command_timeout = {FALSE, FALSE, SIGTERM, 0, 0};
+
+long long monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+int parse_duration(const char *text, long long *nanoseconds) {
+    // Parses a number of seconds with an optional ns, us, ms, s, m, h or d
+    // suffix, like 1.5, 250ms or 2m
+    // Returns 0 on success, -1 if text is not a duration
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (end == text || errno != 0 || value < 0) {
+        return -1;
+    }
+    double scale;
+    if (strcmp(end, "ns") == 0) {
+        scale = 1;
+    }
+    else if (strcmp(end, "us") == 0) {
+        scale = 1e3;
+    }
+    else if (strcmp(end, "ms") == 0) {
+        scale = 1e6;
+    }
+    else if (*end == '\0' || strcmp(end, "s") == 0) {
+        scale = 1e9;
+    }
+    else if (strcmp(end, "m") == 0) {
+        scale = 60e9;
+    }
+    else if (strcmp(end, "h") == 0) {
+        scale = 3600e9;
+    }
+    else if (strcmp(end, "d") == 0) {
+        scale = 86400e9;
+    }
+    else {
+        return -1;
+    }
+    // About 292 years fit in a long long
+    if (value * scale >= 9e18) {
+        return -1;
+    }
+    *nanoseconds = (long long) (value * scale);
+    return 0;
+}
+
+int parse_signal(const char *name) {
+    // Accepts a number, or a name with or without SIG in any case
+    // Returns the signal number, or -1 if there is no such signal
+    char *end;
+    long number = strtol(name, &end, 10);
+    if (end != name && *end == '\0') {
+        return (number > 0 && number < NSIG) ? (int) number : -1;
+    }
+    if (strncasecmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+    int sig;
+    for (sig = 1; sig < NSIG; ++sig) {
+        const char *abbreviation = sigabbrev_np(sig);
+        if (abbreviation != NULL && strcasecmp(name, abbreviation) == 0) {
+            return sig;
+        }
+    }
+    return -1;
+}
+
+void timeout_builtin(char **args, int count) {
+    // timeout DURATION [--signal SIG] [--kill-after DURATION] command [args...]
+    // Sends SIG (TERM by default) to every stage of the pipeline still
+    // running once DURATION has passed, and SIGKILL after --kill-after, if given
+    struct command_timeout timeout = {TRUE, FALSE, SIGTERM, 0, 0};
+    long long duration = -1;
+    const char *error = NULL;
+    int k = 0;
+    while (error == NULL && k < count && (args[k][0] == '-' || duration < 0)) {
+        const char *option = args[k];
+        const char *value = (k + 1 < count) ? args[k + 1] : NULL;
+        if (option[0] != '-') {
+            if (parse_duration(option, &duration) < 0) {
+                error = "invalid duration";
+            }
+            ++k;
+            continue;
+        }
+        if (value == NULL) {
+            error = "missing option value";
+        }
+        else if (strcmp(option, "--signal") == 0 || strcmp(option, "-s") == 0) {
+            if ((timeout.signal = parse_signal(value)) < 0) {
+                error = "invalid signal";
+            }
+        }
+        else if (strcmp(option, "--kill-after") == 0 || strcmp(option, "-k") == 0) {
+            if (parse_duration(value, &timeout.kill_after) < 0) {
+                error = "invalid duration";
+            }
+        }
+        else {
+            error = "invalid option";
+        }
+        k += 2;
+    }
+    if (error == NULL && (duration < 0 || k >= count)) {
+        error = "usage: timeout DURATION [--signal SIG] [--kill-after DURATION] command [args...]";
+    }
+    // Only children can be stopped; built-ins and functions run in the shell
+    if (error == NULL && (is_builtin(args[k]) || find_function(args[k]) != NULL)) {
+        error = "cannot time out a built-in or function";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "[Error]: timeout: %s\n", error);
+        cmd_exit_status = 2;
+        cmd_error = CMD_ERROR;
+        return;
+    }
+    timeout.deadline = monotonic_ns() + duration;
+    command_timeout = timeout;
+    // Run the rest of the line as the command; the deadline stays until
+    // the whole pipeline has been waited for
+    char **saved_opts = opts;
+    int saved_count = optCount;
+    opts = &args[k];
+    optCount = count - k;
+    execute();
+    opts = saved_opts;
+    optCount = saved_count;
+}
+
+struct timespec *command_timeout_remaining(struct timespec *remaining) {
+    // Fills in the time left until something is due, for ppoll()
+    // Returns NULL if there is no deadline
+    if (!command_timeout.active || command_timeout.deadline == 0) {
+        return NULL;
+    }
+    long long left = command_timeout.deadline - monotonic_ns();
+    if (left < 0) {
+        left = 0;
+    }
+    remaining->tv_sec = left / NANOSECONDS_PER_SECOND;
+    remaining->tv_nsec = left % NANOSECONDS_PER_SECOND;
+    return remaining;
+}
+
+void expire_command_timeout(int *pids, int count) {
+    // Signals the children that are still running once the deadline has
+    // passed: first with the chosen signal, then with SIGKILL
+    if (!command_timeout.active || command_timeout.deadline == 0 || monotonic_ns() < command_timeout.deadline) {
+        return;
+    }
+    int sig = command_timeout.expired ? SIGKILL : command_timeout.signal;
+    int k;
+    for (k = 0; k < count; ++k) {
+        if (pids[k] > 0) {
+            kill(pids[k], sig);
+        }
+    }
+    if (!command_timeout.expired && command_timeout.kill_after > 0) {
+        command_timeout.deadline = monotonic_ns() + command_timeout.kill_after;
+    }
+    else {
+        command_timeout.deadline = 0;
+    }
+    command_timeout.expired = TRUE;
+}
+
+void clear_command_timeout() {
+    command_timeout.active = FALSE;
+    command_timeout.expired = FALSE;
+}
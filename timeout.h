@@ -0,0 +1,32 @@
+#pragma once
+#include "shell.h"
+#include <time.h>
+
+// Constants
+// Exit status of a command stopped by timeout, like timeout(1)
+#define TIMEOUT_EXIT_CODE 124
+#define NANOSECONDS_PER_SECOND 1000000000LL
+
+// The deadline of the current pipeline, set by timeout
+struct command_timeout {
+    char active;
+    // The signal has been sent
+    char expired;
+    int signal;
+    // Monotonic nanoseconds, or 0 once nothing more is due
+    long long deadline;
+    // Time between the signal and SIGKILL, or 0 for no SIGKILL
+    long long kill_after;
+};
+
+// Function type signatures
+long long monotonic_ns();
+int parse_duration(const char *text, long long *nanoseconds);
+int parse_signal(const char *name);
+void timeout_builtin(char **args, int count);
+struct timespec *command_timeout_remaining(struct timespec *remaining);
+void expire_command_timeout(int *pids, int count);
+void clear_command_timeout();
+
+// Variables
+extern struct command_timeout command_timeout;
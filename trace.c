@@ -0,0 +1,144 @@
+#include "trace.h"
+
+int trace_fd = NO_FD;
+int record_fd = NO_FD;
+// Children that have been started but not reaped yet
+struct trace_process trace_processes[TRACE_MAX_PROCESSES];
+int trace_process_next = 0;
+
+void init_trace() {
+    // Spans are appended to $SHIP_TRACE as Chrome trace events
+    // The closing ] is optional in that format, so every process (including
+    // the readline and command substitution children) can append on its own
+    const char *path = getenv(TRACE_ENV_VAR);
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+    if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+        print_error();
+        trace_fd = NO_FD;
+        return;
+    }
+    struct stat trace_stat;
+    if (fstat(trace_fd, &trace_stat) == 0 && trace_stat.st_size == 0) {
+        write(trace_fd, "[\n", 2);
+    }
+}
+
+long long trace_now() {
+    // Microseconds on the monotonic clock, which all processes share
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static size_t append_json_string(char *buf, size_t index, size_t size, const char *s) {
+    // Appends s as a quoted JSON string, truncating it to fit
+    // Leaves room for the closing quote and the rest of the event
+    size_t limit = size - 64;
+    buf[index++] = '"';
+    for (; *s != '\0' && index < limit; ++s) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            buf[index++] = '\\';
+            buf[index++] = c;
+        }
+        else if (c < 0x20) {
+            index += snprintf(&buf[index], size - index, "\\u%04x", c);
+        }
+        else {
+            buf[index++] = c;
+        }
+    }
+    buf[index++] = '"';
+    return index;
+}
+
+void trace_span(const char *name, const char *category, long long start, int tid, const char *detail, int status) {
+    // Writes one complete ("X") event with a single write() so that events
+    // from several processes never interleave
+    char event[TRACE_EVENT_MAX_SIZE];
+    long long end = trace_now();
+    size_t index = snprintf(event, sizeof(event), "{\"name\":");
+    index = append_json_string(event, index, TRACE_DETAIL_MAX_SIZE, name);
+    index += snprintf(&event[index], sizeof(event) - index,
+                      ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"pid\":%d,\"argv\":",
+                      category, start, end - start, (int) getpid(), tid, tid);
+    index = append_json_string(event, index, sizeof(event), detail != NULL ? detail : "");
+    index += snprintf(&event[index], sizeof(event) - index, ",\"status\":%d}},\n", status);
+    write(trace_fd, event, index);
+}
+
+void trace_join_argv(char **argv, char *buf, size_t size) {
+    // Joins argv with spaces into buf, truncating it to fit
+    size_t index = 0;
+    buf[0] = '\0';
+    char **arg;
+    for (arg = argv; arg != NULL && *arg != NULL && index + 1 < size; ++arg) {
+        int written = snprintf(&buf[index], size - index, (arg == argv) ? "%s" : " %s", *arg);
+        if (written < 0) {
+            break;
+        }
+        index += written;
+    }
+}
+
+void trace_process_start(int pid, char **argv) {
+    // The table is a ring, so a child that is never reaped eventually
+    // gets overwritten instead of leaking a slot
+    struct trace_process *process = &trace_processes[trace_process_next];
+    trace_process_next = (trace_process_next + 1) % TRACE_MAX_PROCESSES;
+    process->pid = pid;
+    process->start = trace_now();
+    trace_join_argv(argv, process->detail, sizeof(process->detail));
+}
+
+void trace_process_end(int pid, int wait_status) {
+    int k;
+    for (k = 0; k < TRACE_MAX_PROCESSES; ++k) {
+        if (trace_processes[k].pid == pid) {
+            int status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+            // Name the span after the command
+            char name[TRACE_NAME_MAX_SIZE];
+            size_t length = strcspn(trace_processes[k].detail, " ");
+            if (length >= sizeof(name)) {
+                length = sizeof(name) - 1;
+            }
+            memcpy(name, trace_processes[k].detail, length);
+            name[length] = '\0';
+            // One track per child, so pipeline stages and parallel jobs
+            // show up side by side
+            trace_span(name, "process", trace_processes[k].start, pid, trace_processes[k].detail, status);
+            trace_processes[k].pid = 0;
+            return;
+        }
+    }
+}
+
+void init_record() {
+    // Input lines are appended to $SHIP_RECORD so that a session can be
+    // replayed later with bench/replay
+    const char *path = getenv(RECORD_ENV_VAR);
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+    if ((record_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) < 0) {
+        print_error();
+        record_fd = NO_FD;
+    }
+}
+
+void record_input(const char *line) {
+    // One "<monotonic microseconds>\t<line>" record per input line, written
+    // with a single write() like the trace events
+    if (record_fd == NO_FD) {
+        return;
+    }
+    char record[INPUT_BUF_SIZE + 32];
+    int length = snprintf(record, sizeof(record), "%lld\t%s\n", trace_now(), line);
+    if (length >= (int) sizeof(record)) {
+        length = sizeof(record) - 1;
+        record[length - 1] = '\n';
+    }
+    write(record_fd, record, length);
+}
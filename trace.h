@@ -0,0 +1,34 @@
+#pragma once
+#include "shell.h"
+#include <sys/stat.h>
+
+// Constants
+#define TRACE_ENV_VAR "SHIP_TRACE"
+#define RECORD_ENV_VAR "SHIP_RECORD"
+#define TRACE_EVENT_MAX_SIZE 4096
+#define TRACE_DETAIL_MAX_SIZE 1024
+#define TRACE_NAME_MAX_SIZE 64
+#define TRACE_MAX_PROCESSES 256
+// Call sites only pay for this comparison when tracing is off
+#define TRACING (trace_fd != NO_FD)
+
+// A child process whose span ends when it is reaped
+struct trace_process {
+    int pid;
+    long long start;
+    char detail[TRACE_DETAIL_MAX_SIZE];
+};
+
+// Function type signatures
+void init_trace();
+long long trace_now();
+void trace_span(const char *name, const char *category, long long start, int tid, const char *detail, int status);
+void trace_join_argv(char **argv, char *buf, size_t size);
+void trace_process_start(int pid, char **argv);
+void trace_process_end(int pid, int wait_status);
+void init_record();
+void record_input(const char *line);
+
+// Variables
+extern int trace_fd;
+extern int record_fd;
@@ -0,0 +1,126 @@
+#include "variables.h"
+#include "functions.h"
+
+struct hash_table *shell_vars = NULL;
+// Formatted values of special parameters such as $? and $$
+char special_var_buf[VAR_SPECIAL_BUF_SIZE];
+
+void init_variables() {
+    if (shell_vars == NULL) {
+        shell_vars = hash_table_create(HASH_TABLE_DEFAULT_BUCKETS);
+    }
+}
+
+const char *get_var(const char *name) {
+    return get_var_n(name, strlen(name));
+}
+
+const char *get_var_n(const char *name, size_t name_length) {
+    // Returns NULL if the variable is unset
+    if (name_length == 1 && name[0] == '?') {
+        snprintf(special_var_buf, sizeof(special_var_buf), "%d", last_exit_status);
+        return special_var_buf;
+    }
+    if (name_length == 1 && name[0] == '$') {
+        snprintf(special_var_buf, sizeof(special_var_buf), "%d", (int) getpid());
+        return special_var_buf;
+    }
+    if ((name[0] >= '0' && name[0] <= '9') || (name_length == 1 && strchr("#@*", name[0]) != NULL)) {
+        return get_positional_param(name, name_length);
+    }
+    struct shell_var *var = (struct shell_var *) hash_table_get_n(shell_vars, name, name_length);
+    if (var != NULL) {
+        return var->value;
+    }
+    // Fall back to the environment
+    char env_name[name_length + 1];
+    strncpy(env_name, name, name_length);
+    env_name[name_length] = '\0';
+    return getenv(env_name);
+}
+
+void set_var(const char *name, const char *value) {
+    set_var_n(name, value, strlen(value));
+}
+
+void set_var_n(const char *name, const char *value, size_t value_length) {
+    struct shell_var *var = (struct shell_var *) hash_table_get(shell_vars, name);
+    if (var == NULL) {
+        var = (struct shell_var *) malloc(sizeof(struct shell_var));
+        var->capacity = value_length + 1;
+        var->value = (char *) malloc(var->capacity * sizeof(char));
+        hash_table_put(shell_vars, name, var);
+    }
+    else if (value_length + 1 > var->capacity) {
+        // Copy before freeing in case value points into the old buffer
+        char *new_value = (char *) malloc((value_length + 1) * sizeof(char));
+        memcpy(new_value, value, value_length);
+        free(var->value);
+        var->value = new_value;
+        var->capacity = value_length + 1;
+        value = var->value;
+    }
+    // Reuse the existing buffer so that loops don't allocate per assignment
+    memmove(var->value, value, value_length);
+    var->value[value_length] = '\0';
+    // Keep exported variables in sync with the environment
+    if (getenv(name) != NULL) {
+        setenv(name, var->value, 1);
+    }
+}
+
+void unset_var(const char *name) {
+    struct shell_var *var = (struct shell_var *) hash_table_remove(shell_vars, name);
+    if (var != NULL) {
+        free(var->value);
+        free(var);
+    }
+    unsetenv(name);
+}
+
+void export_var(const char *name) {
+    const char *value = get_var(name);
+    setenv(name, value != NULL ? value : "", 1);
+}
+
+size_t var_name_length(const char *s) {
+    // Returns the length of the valid variable name at the start of s
+    size_t length = 0;
+    if (!(s[0] == '_' || (s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z'))) {
+        return 0;
+    }
+    while (s[length] == '_'
+        || (s[length] >= 'a' && s[length] <= 'z')
+        || (s[length] >= 'A' && s[length] <= 'Z')
+        || (s[length] >= '0' && s[length] <= '9')
+    ) {
+        ++length;
+    }
+    return length;
+}
+
+size_t special_param_length(const char *s, int braced) {
+    // Returns the length of the special or positional parameter name at the
+    // start of s ($?, $$, $#, $@, $*, $1, ${10})
+    if (s[0] != '\0' && strchr("?$#@*", s[0]) != NULL) {
+        return 1;
+    }
+    size_t length = 0;
+    while (s[length] >= '0' && s[length] <= '9' && (braced || length == 0)) {
+        ++length;
+    }
+    return length;
+}
+
+int try_assignment(const char *word) {
+    // Performs the assignment if word has the form NAME=VALUE
+    size_t name_length = var_name_length(word);
+    if (name_length == 0 || word[name_length] != '=') {
+        return FALSE;
+    }
+    char name[name_length + 1];
+    strncpy(name, word, name_length);
+    name[name_length] = '\0';
+    set_var(name, &word[name_length + 1]);
+    return TRUE;
+}
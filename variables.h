@@ -0,0 +1,23 @@
+#pragma once
+#include "shell.h"
+#include "hash_table.h"
+
+// Constants
+#define VAR_SPECIAL_BUF_SIZE 32
+
+struct shell_var {
+    char *value;
+    size_t capacity;
+};
+
+// Function type signatures
+void init_variables();
+const char *get_var(const char *name);
+const char *get_var_n(const char *name, size_t name_length);
+void set_var(const char *name, const char *value);
+void set_var_n(const char *name, const char *value, size_t value_length);
+void unset_var(const char *name);
+void export_var(const char *name);
+size_t var_name_length(const char *s);
+size_t special_param_length(const char *s, int braced);
+int try_assignment(const char *word);